@@ -0,0 +1,52 @@
+/**
+ * Meditation Band Breath Curve
+ *
+ * One breath cycle as a fixed-point table built at compile time, and the
+ * integer lookup the LED renderer calls every frame. The C3 has no FPU, so
+ * a per-frame sin() would go through soft-float.
+ *
+ * Header only and free of Arduino so the host benchmark (pio test -e native)
+ * times the same code the firmware runs.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define BREATH_TABLE_BITS      8      // 256 steps per breath cycle
+
+// Expands f(i) for i = 0..255 into an initialiser list
+#define TABLE_4(f, i)   f(i), f(i + 1), f(i + 2), f(i + 3)
+#define TABLE_16(f, i)  TABLE_4(f, i), TABLE_4(f, i + 4), TABLE_4(f, i + 8), TABLE_4(f, i + 12)
+#define TABLE_64(f, i)  TABLE_16(f, i), TABLE_16(f, i + 16), TABLE_16(f, i + 32), TABLE_16(f, i + 48)
+#define TABLE_256(f)    TABLE_64(f, 0), TABLE_64(f, 64), TABLE_64(f, 128), TABLE_64(f, 192)
+
+constexpr double BREATH_PI = 3.14159265358979323846;
+
+// (1 - cos) / 2 in Q16
+constexpr double breathCos(double x2, int n, double term, double sum) {
+  return n > 12 ? sum : breathCos(x2, n + 1, -term * x2 / ((2 * n - 1) * (2 * n)),
+                                  sum - term * x2 / ((2 * n - 1) * (2 * n)));
+}
+
+constexpr uint16_t breathStep(int i) {
+  // cos(2 pi i / N) = -cos(x) with x in [-pi, pi), where the series converges
+  return (uint16_t)((1.0 + breathCos(
+    (BREATH_PI * (2.0 * i / (1 << BREATH_TABLE_BITS) - 1)) * (BREATH_PI * (2.0 * i / (1 << BREATH_TABLE_BITS) - 1)),
+    1, 1.0, 1.0)) / 2 * 65535 + 0.5);
+}
+
+constexpr uint16_t BREATH_TABLE[1 << BREATH_TABLE_BITS] = {TABLE_256(breathStep)};
+
+static_assert(BREATH_TABLE[0] == 0 && BREATH_TABLE[1 << (BREATH_TABLE_BITS - 1)] == 65535,
+              "Breath table must run from empty to full");
+
+inline uint32_t breathCurve(uint32_t phase) {
+  // Breath cycle in Q16 from the table; the top bits of the Q16 phase pick
+  // the step and the rest interpolate
+  uint32_t step = phase >> (16 - BREATH_TABLE_BITS);
+  uint32_t fraction = phase & ((1 << (16 - BREATH_TABLE_BITS)) - 1);
+  int32_t from = BREATH_TABLE[step];
+  int32_t to = BREATH_TABLE[(step + 1) & ((1 << BREATH_TABLE_BITS) - 1)];
+  return from + (((to - from) * (int32_t)fraction) >> (16 - BREATH_TABLE_BITS));
+}
@@ -0,0 +1,222 @@
+/**
+ * Meditation Band Session Journal
+ *
+ * See SessionJournal.h.
+ */
+
+#include "SessionJournal.h"
+
+#include <string.h>
+
+uint32_t journalSectorCount = 0;
+uint32_t journalUsedSectors = 0;
+uint32_t journalTailSector = 0;
+uint32_t journalHeadSector = 0;
+uint32_t journalHeadOffset = 0;
+uint32_t journalSectorSeq = 0;
+
+alignas(4) static uint8_t journalRecordBuffer[sizeof(JournalRecordHeader) + JOURNAL_MAX_PAYLOAD];
+
+// =============================================================================
+// SESSION JOURNAL
+// =============================================================================
+
+// Every change is appended as a small CRC-protected record; RAM holds the
+// live state, rebuilt by replaying the log at mount. Sectors are filled
+// round-robin, and the oldest is reclaimed only when the log wraps, by
+// re-appending whatever in it is still live, so each change costs one small
+// write instead of a rewrite.
+
+uint32_t journalRecordSize(uint16_t length) {
+  return (sizeof(JournalRecordHeader) + length + 3) & ~3u;
+}
+
+bool journalReadSectorHeader(uint32_t sector, JournalSectorHeader* header) {
+  if (!journalFlashRead(sector * FLASH_SECTOR_SIZE, header, sizeof(*header))) {
+    return false;
+  }
+  return header->magic == JOURNAL_SECTOR_MAGIC &&
+         header->crc == flashCRC(header, offsetof(JournalSectorHeader, crc));
+}
+
+bool journalMount(uint32_t partitionSize) {
+  journalSectorCount = partitionSize / FLASH_SECTOR_SIZE;
+  journalUsedSectors = 0;
+  journalTailSector = 0;
+  journalHeadSector = 0;
+  journalHeadOffset = 0;
+  journalSectorSeq = 0;
+  if (journalSectorCount < 2) {
+    journalSectorCount = 0;
+    return false;
+  }
+
+  // The newest sector is the head
+  JournalSectorHeader header;
+  for (uint32_t i = 0; i < journalSectorCount; i++) {
+    if (journalReadSectorHeader(i, &header) &&
+        (journalUsedSectors == 0 || header.sectorSeq > journalSectorSeq)) {
+      journalHeadSector = i;
+      journalSectorSeq = header.sectorSeq;
+      journalUsedSectors = 1;
+    }
+  }
+
+  if (journalUsedSectors == 0) {
+    // Fresh partition, the first append opens sector 0
+    return true;
+  }
+
+  // Walk back through consecutively numbered sectors to find the tail
+  journalTailSector = journalHeadSector;
+  for (uint32_t k = 1; k < journalSectorCount; k++) {
+    uint32_t sector = (journalHeadSector + journalSectorCount - k) % journalSectorCount;
+    if (!journalReadSectorHeader(sector, &header) ||
+        header.sectorSeq != journalSectorSeq - k) {
+      break;
+    }
+    journalTailSector = sector;
+    journalUsedSectors++;
+  }
+
+  // Replay oldest to newest
+  for (uint32_t k = 0; k < journalUsedSectors; k++) {
+    uint32_t sector = (journalTailSector + k) % journalSectorCount;
+
+    journalReadSectorHeader(sector, &header);
+    if (header.nextSessionSeq > nextSessionSeq) {
+      nextSessionSeq = header.nextSessionSeq;
+    }
+
+    uint32_t end = journalScanSector(sector, journalApply);
+    if (sector == journalHeadSector) {
+      journalHeadOffset = end;
+    }
+  }
+
+  // Power was cut between opening a sector and reclaiming the oldest. The
+  // oldest is only erased once everything live has been copied, so finish
+  // the reclaim, or if the copy itself was torn, drop the new sector and
+  // let the next append redo it.
+  if (journalUsedSectors == journalSectorCount) {
+    if (journalHeadOffset < FLASH_SECTOR_SIZE) {
+      journalReclaimOldest();
+    } else {
+      journalFlashErase(journalHeadSector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+      journalHeadSector = (journalHeadSector + journalSectorCount - 1) % journalSectorCount;
+      journalHeadOffset = FLASH_SECTOR_SIZE;
+      journalSectorSeq--;
+      journalUsedSectors--;
+    }
+  }
+
+  return true;
+}
+
+uint32_t journalScanSector(uint32_t sector,
+                           void (*visit)(uint8_t, const uint8_t*, uint16_t)) {
+  // Returns the offset after the last valid record. A corrupt record ends
+  // the sector, and the whole sector is reported full so nothing is
+  // appended after it.
+  uint32_t base = sector * FLASH_SECTOR_SIZE;
+  uint32_t offset = sizeof(JournalSectorHeader);
+  JournalRecordHeader* record = (JournalRecordHeader*)journalRecordBuffer;
+
+  while (offset + sizeof(JournalRecordHeader) <= FLASH_SECTOR_SIZE) {
+    journalFlashRead(base + offset, record, sizeof(JournalRecordHeader));
+
+    if (record->magic == 0xFF) {
+      return offset;
+    }
+
+    uint16_t length = record->length;
+    if (record->magic != JOURNAL_RECORD_MAGIC || length > JOURNAL_MAX_PAYLOAD ||
+        offset + journalRecordSize(length) > FLASH_SECTOR_SIZE) {
+      return FLASH_SECTOR_SIZE;
+    }
+
+    journalFlashRead(base + offset + sizeof(JournalRecordHeader),
+                     journalRecordBuffer + sizeof(JournalRecordHeader), length);
+
+    uint32_t crc = record->crc;
+    record->crc = 0;
+    if (crc != flashCRC(journalRecordBuffer, sizeof(JournalRecordHeader) + length)) {
+      return FLASH_SECTOR_SIZE;
+    }
+
+    visit(record->type, journalRecordBuffer + sizeof(JournalRecordHeader), length);
+    offset += journalRecordSize(length);
+  }
+
+  return offset;
+}
+
+bool journalWrite(uint8_t type, const void* payload, uint16_t length) {
+  // Caller guarantees the record fits in the head sector
+  JournalRecordHeader* record = (JournalRecordHeader*)journalRecordBuffer;
+  uint32_t size = journalRecordSize(length);
+
+  memset(journalRecordBuffer, 0, size);
+  record->magic = JOURNAL_RECORD_MAGIC;
+  record->type = type;
+  record->length = length;
+  record->crc = 0;
+  memcpy(journalRecordBuffer + sizeof(JournalRecordHeader), payload, length);
+  record->crc = flashCRC(journalRecordBuffer, sizeof(JournalRecordHeader) + length);
+
+  bool ok = journalFlashWrite(journalHeadSector * FLASH_SECTOR_SIZE + journalHeadOffset,
+                              journalRecordBuffer, size);
+  journalHeadOffset += size;
+  journalWritten(length);
+  return ok;
+}
+
+void journalOpenSector(uint32_t sector) {
+  journalFlashErase(sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+
+  JournalSectorHeader header;
+  header.magic = JOURNAL_SECTOR_MAGIC;
+  header.sectorSeq = ++journalSectorSeq;
+  header.nextSessionSeq = nextSessionSeq;
+  header.crc = flashCRC(&header, offsetof(JournalSectorHeader, crc));
+  journalFlashWrite(sector * FLASH_SECTOR_SIZE, &header, sizeof(header));
+
+  journalHeadSector = sector;
+  journalHeadOffset = sizeof(JournalSectorHeader);
+}
+
+void journalReclaimOldest() {
+  // Re-append the current state of anything the oldest sector still holds.
+  // It came from one sector, so it fits in the freshly opened head.
+  journalScanSector(journalTailSector, journalMarkLive);
+  journalCarryLive();
+
+  journalFlashErase(journalTailSector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+  journalTailSector = (journalTailSector + 1) % journalSectorCount;
+  journalUsedSectors--;
+}
+
+bool journalAppend(uint8_t type, const void* payload, uint16_t length) {
+  if (journalSectorCount == 0 || length > JOURNAL_MAX_PAYLOAD) {
+    return false;
+  }
+
+  if (journalUsedSectors == 0) {
+    journalOpenSector(0);
+    journalTailSector = 0;
+    journalUsedSectors = 1;
+  }
+
+  while (journalHeadOffset + journalRecordSize(length) > FLASH_SECTOR_SIZE) {
+    journalOpenSector((journalHeadSector + 1) % journalSectorCount);
+    journalUsedSectors++;
+
+    // Keep one erased sector ahead of the head. Live data is far smaller
+    // than a sector, so this settles after one or two rounds.
+    if (journalUsedSectors == journalSectorCount) {
+      journalReclaimOldest();
+    }
+  }
+
+  return journalWrite(type, payload, length);
+}
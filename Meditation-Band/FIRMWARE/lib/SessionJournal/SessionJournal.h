@@ -0,0 +1,88 @@
+/**
+ * Meditation Band Session Journal
+ *
+ * Log-structured store for the plan, totals, checkpoint and acked mark, on
+ * its own flash partition. Records are opaque here: the firmware decides
+ * what each type means, replays them at mount and re-appends whatever is
+ * still live when the oldest sector is reclaimed.
+ *
+ * Free of Arduino and ESP-IDF so it also builds on the host for tests
+ * (pio test -e native). The firmware supplies flash access, replay and
+ * reclaim through the hooks at the end. Not thread-safe: callers hold the
+ * journal mutex.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <SessionRing.h>
+
+// =============================================================================
+// CONSTANTS
+// =============================================================================
+
+#define JOURNAL_SECTOR_MAGIC   0x4C4E524A  // "JRNL"
+#define JOURNAL_RECORD_MAGIC   0xA5
+#define JOURNAL_MAX_PAYLOAD    112
+
+// =============================================================================
+// RECORDS
+// =============================================================================
+
+struct JournalSectorHeader {
+  uint32_t magic;
+  uint32_t sectorSeq;        // Increases each time a sector is opened
+  uint32_t nextSessionSeq;   // Session counter when the sector was opened
+  uint32_t crc;
+};
+
+// Records carry no sequence number of their own. They are only ever
+// appended, so their order is the sector's sectorSeq and then their offset
+// in it, and replay applies them in that order. Each is checked by a full
+// CRC32 over header and payload; a record that fails ends its sector.
+struct JournalRecordHeader {
+  uint8_t magic;             // 0xFF = erased, end of the log
+  uint8_t type;              // Defined by the firmware
+  uint16_t length;           // Payload bytes
+  uint32_t crc;              // CRC32 of the record with this field zeroed
+};
+
+// =============================================================================
+// STATE
+// =============================================================================
+
+extern uint32_t journalSectorCount;  // 0 until mounted
+extern uint32_t journalUsedSectors;
+extern uint32_t journalTailSector;   // Oldest sector holding records
+extern uint32_t journalHeadSector;   // Sector being appended to
+extern uint32_t journalHeadOffset;   // Next free byte in the head sector
+extern uint32_t journalSectorSeq;
+
+// =============================================================================
+// SESSION JOURNAL
+// =============================================================================
+
+bool journalMount(uint32_t partitionSize);
+bool journalAppend(uint8_t type, const void* payload, uint16_t length);
+bool journalWrite(uint8_t type, const void* payload, uint16_t length);
+uint32_t journalRecordSize(uint16_t length);
+bool journalReadSectorHeader(uint32_t sector, JournalSectorHeader* header);
+uint32_t journalScanSector(uint32_t sector,
+                           void (*visit)(uint8_t, const uint8_t*, uint16_t));
+void journalOpenSector(uint32_t sector);
+void journalReclaimOldest();
+
+// =============================================================================
+// HOOKS
+// =============================================================================
+
+// Supplied by the firmware, or by the host test harness. Offsets are from
+// the start of the journal partition. flashCRC is shared with the ring.
+bool journalFlashRead(uint32_t offset, void* data, size_t length);
+bool journalFlashWrite(uint32_t offset, const void* data, size_t length);
+bool journalFlashErase(uint32_t offset, size_t length);
+void journalApply(uint8_t type, const uint8_t* payload, uint16_t length);     // Replay at mount
+void journalMarkLive(uint8_t type, const uint8_t* payload, uint16_t length);  // In the sector being reclaimed
+void journalCarryLive();     // Re-append what was marked, with journalWrite
+void journalWritten(uint16_t length);  // After each record, for wear accounting
@@ -0,0 +1,672 @@
+/**
+ * Meditation Band Session Ring
+ *
+ * See SessionRing.h.
+ */
+
+#include "SessionRing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+uint32_t ringSlotCount = 0;
+uint32_t ringV1Sectors[RING_MAX_SECTORS / 32] = {0};
+uint32_t ringHead = 0;
+uint16_t* ringIndex = nullptr;
+uint32_t ringIndexMask = 0;
+uint32_t ringIndexUsed = 0;
+uint32_t ringTail = 0;
+uint32_t ringAckedUpTo = 0;
+int32_t ringErasedSector = -1;
+int pendingSessionCount = 0;
+
+uint32_t nextSessionSeq = 1;
+uint32_t syncCursor = 1;
+uint32_t sendCursor = 1;
+uint32_t sendSlot = 0;
+
+// =============================================================================
+// SESSION RING
+// =============================================================================
+
+// Sessions live in their own partition as fixed-size slots written round-
+// robin, so thousands fit and RAM holds only the head and tail. Appending
+// writes one slot; acknowledging programs the slot's pending byte to 0 in
+// place, which NOR flash allows without an erase; the tail then steps past
+// acknowledged slots. A sector is erased only as the head enters it. If the
+// tail is still inside, the ring is full and RING_OVERFLOW_POLICY decides
+// whether that sector's sessions or the new one are dropped.
+//
+// A power cut can interrupt any flash operation, so a slot is written body
+// first and its magic byte last: a slot counts only if the magic is set and
+// the CRC matches. A torn slot is skipped but never reused before its
+// sector is erased, and a torn ack reads as acked (the app had sent it).
+
+bool ringMount(uint32_t partitionSize) {
+  uint32_t sectorCount = partitionSize / FLASH_SECTOR_SIZE;
+  if (sectorCount > RING_MAX_SECTORS) {
+    sectorCount = RING_MAX_SECTORS;
+  }
+  ringSlotCount = sectorCount * RING_SLOTS_PER_SECTOR;
+  ringHead = 0;
+  ringTail = 0;
+  pendingSessionCount = 0;
+  ringErasedSector = -1;
+
+  // Seqs carry on past anything acked, even if the ring itself was lost
+  if (nextSessionSeq <= ringAckedUpTo) {
+    nextSessionSeq = ringAckedUpTo + 1;
+  }
+
+  // Slots are written in seq order, so the sector whose first valid slot
+  // has the highest seq holds the head. This also finds which sectors are
+  // still in the version 1 layout.
+  Session session;
+  bool found = false;
+  uint32_t headSector = 0;
+  uint32_t headSeq = 0;
+  memset(ringV1Sectors, 0, sizeof(ringV1Sectors));
+  for (uint32_t i = 0; i < sectorCount; i++) {
+    if (ringSectorFirst(i, &session) && (!found || session.seq > headSeq)) {
+      headSector = i;
+      headSeq = session.seq;
+      found = true;
+    }
+  }
+
+  // Twice as many buckets as slots keeps probes short, one bucket is 2 bytes.
+  // Left null if there is no room, acks then scan the ring.
+  uint32_t buckets = 1;
+  while (buckets < ringSlotCount * 2) {
+    buckets <<= 1;
+  }
+  free(ringIndex);
+  ringIndex = (uint16_t*)calloc(buckets, sizeof(uint16_t));
+  ringIndexMask = buckets - 1;
+  ringIndexUsed = 0;
+
+  if (!found) {
+    // Fresh partition
+    return true;
+  }
+
+  // The head follows the last programmed slot in that sector, including a
+  // torn one, since flash can't be rewritten without an erase
+  uint32_t sectorStart = headSector * RING_SLOTS_PER_SECTOR;
+  bool headV1 = ringSectorV1(headSector);
+  ringHead = sectorStart;
+  for (uint32_t i = sectorStart; i < sectorStart + RING_SLOTS_PER_SECTOR; i++) {
+    bool valid = ringReadSlot(i, &session, nullptr);
+    if (valid && session.seq >= nextSessionSeq) {
+      nextSessionSeq = session.seq + 1;
+    }
+    if (valid || (!headV1 && !ringSlotErased(i))) {
+      ringHead = i + 1;
+    }
+  }
+
+  // New records never go into a version 1 sector, start on the next one
+  if (headV1) {
+    ringHead = sectorStart + RING_SLOTS_PER_SECTOR;
+  }
+  ringHead %= ringSlotCount;
+
+  // The oldest slots are in the first written sector after the head's
+  uint32_t oldestSector = headSector;
+  for (uint32_t k = 1; k < sectorCount; k++) {
+    uint32_t sector = (headSector + k) % sectorCount;
+    if (ringSectorFirst(sector, &session)) {
+      oldestSector = sector;
+      break;
+    }
+  }
+
+  // Count what is still pending, the first one is the tail
+  uint32_t oldest = oldestSector * RING_SLOTS_PER_SECTOR;
+  uint32_t span = (ringHead + ringSlotCount - oldest) % ringSlotCount;
+  if (span == 0) {
+    span = ringSlotCount;
+  }
+
+  ringTail = ringHead;
+  for (uint32_t k = 0; k < span; k++) {
+    uint32_t i = (oldest + k) % ringSlotCount;
+    if (ringSlotPending(i)) {
+      if (pendingSessionCount == 0) {
+        ringTail = i;
+      }
+      pendingSessionCount++;
+    }
+  }
+
+  ringIndexBuild();
+  return true;
+}
+
+bool ringSectorFirst(uint32_t sector, Session* first) {
+  // A sector is known by its first valid slot. Slot 0 may be torn, or
+  // spoiled by a failed write the head moved past, so look further. A
+  // sector with none in the current layout may be in the version 1 layout,
+  // whose sessions are served and acked in place.
+  for (int layout = 0; layout < 2; layout++) {
+    ringSetSectorV1(sector, layout == 1);
+    for (uint32_t i = 0; i < RING_SLOTS_PER_SECTOR; i++) {
+      if (ringReadSlot(sector * RING_SLOTS_PER_SECTOR + i, first, nullptr)) {
+        return true;
+      }
+    }
+  }
+  ringSetSectorV1(sector, false);
+  return false;
+}
+
+bool ringSectorV1(uint32_t sector) {
+  return (ringV1Sectors[sector / 32] >> (sector % 32)) & 1;
+}
+
+void ringSetSectorV1(uint32_t sector, bool v1) {
+  uint32_t bit = 1UL << (sector % 32);
+  if (v1) {
+    ringV1Sectors[sector / 32] |= bit;
+  } else {
+    ringV1Sectors[sector / 32] &= ~bit;
+  }
+}
+
+uint32_t ringV1SectorCount() {
+  uint32_t count = 0;
+  for (uint32_t word : ringV1Sectors) {
+    count += __builtin_popcount(word);
+  }
+  return count;
+}
+
+size_t ringSlotOffset(uint32_t slot) {
+  uint32_t sector = slot / RING_SLOTS_PER_SECTOR;
+  uint32_t index = slot % RING_SLOTS_PER_SECTOR;
+  size_t slotSize = ringSectorV1(sector) ? sizeof(RingSlotV1) : sizeof(RingSlot);
+  return sector * FLASH_SECTOR_SIZE + index * slotSize;
+}
+
+bool ringReadSlot(uint32_t slot, Session* out, bool* pending) {
+  if (ringSectorV1(slot / RING_SLOTS_PER_SECTOR)) {
+    return ringReadSlotV1(slot, out, pending);
+  }
+
+  RingSlot contents;
+  if (!ringFlashRead(ringSlotOffset(slot), &contents, sizeof(RingSlot))) {
+    return false;
+  }
+  const uint8_t* checked = (const uint8_t*)&contents + offsetof(RingSlotHeader, seq);
+  if (contents.header.magic != RING_SLOT_MAGIC ||
+      contents.header.version != RING_RECORD_VERSION ||
+      contents.header.crc != (uint16_t)flashCRC(checked, sizeof(RingSlot) - offsetof(RingSlotHeader, seq))) {
+    return false;
+  }
+
+  const SessionRecord& record = contents.record;
+  unpackUUID(record.uuid, out->uuid);
+  out->flags = record.flags & ~SESSION_FLAG_MINUTES;
+  out->seq = contents.header.seq;
+  out->startTime = record.startTime;
+  out->durationSeconds = (record.flags & SESSION_FLAG_MINUTES) ? record.duration * 60 : record.duration;
+  out->endTime = record.startTime + out->durationSeconds;
+  if (pending != nullptr) {
+    *pending = contents.header.pending == RING_PENDING && out->seq > ringAckedUpTo;
+  }
+  return true;
+}
+
+bool ringReadSlotV1(uint32_t slot, Session* out, bool* pending) {
+  // Half as many slots fit a sector, the rest of its indices are empty
+  if (slot % RING_SLOTS_PER_SECTOR >= RING_V1_SLOTS_PER_SECTOR) {
+    return false;
+  }
+
+  RingSlotV1 contents;
+  if (!ringFlashRead(ringSlotOffset(slot), &contents, sizeof(RingSlotV1))) {
+    return false;
+  }
+  if (contents.magic != RING_SLOT_MAGIC ||
+      contents.crc != flashCRC(&contents.session, sizeof(contents.session))) {
+    return false;
+  }
+
+  memcpy(out->uuid, contents.session.uuid, sizeof(out->uuid));
+  out->flags = contents.session.flags;
+  out->seq = contents.session.seq;
+  out->startTime = contents.session.startTime;
+  out->endTime = contents.session.endTime;
+  out->durationSeconds = contents.session.durationSeconds;
+  if (pending != nullptr) {
+    *pending = contents.pending == RING_PENDING && out->seq > ringAckedUpTo;
+  }
+  return true;
+}
+
+bool ringSlotPending(uint32_t slot) {
+  Session session;
+  bool pending;
+  return ringReadSlot(slot, &session, &pending) && pending;
+}
+
+bool ringSectorErased(uint32_t sector) {
+  // Reading a sector is far cheaper than erasing it again
+  if (ringSectorV1(sector)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < RING_SLOTS_PER_SECTOR; i++) {
+    if (!ringSlotErased(sector * RING_SLOTS_PER_SECTOR + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ringSlotErased(uint32_t slot) {
+  // Only asked of new-layout slots
+  uint8_t bytes[sizeof(RingSlot)];
+  ringFlashRead(ringSlotOffset(slot), bytes, sizeof(bytes));
+  for (size_t i = 0; i < sizeof(bytes); i++) {
+    if (bytes[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t ringSpan() {
+  // Slots from the tail up to the head. They only meet while sessions are
+  // pending when every slot is in use.
+  uint32_t span = (ringHead + ringSlotCount - ringTail) % ringSlotCount;
+  return (span == 0 && pendingSessionCount > 0) ? ringSlotCount : span;
+}
+
+bool ringAppend(const Session& session) {
+  if (ringSlotCount == 0) {
+    return false;
+  }
+
+  if (ringHead % RING_SLOTS_PER_SECTOR == 0) {
+    // Entering a sector from the previous lap. The tail inside means full.
+    if (pendingSessionCount > 0 &&
+        ringTail / RING_SLOTS_PER_SECTOR == ringHead / RING_SLOTS_PER_SECTOR) {
+      if (RING_OVERFLOW_POLICY == OverflowPolicy::DROP_NEWEST) {
+        ringOverflowed(1, OverflowPolicy::DROP_NEWEST);
+        return false;
+      }
+      ringEvictTailSector();
+    }
+
+    uint32_t sector = ringHead / RING_SLOTS_PER_SECTOR;
+    if ((int32_t)sector != ringErasedSector && !ringSectorErased(sector)) {
+      ringFlashErase(sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+      ringSetSectorV1(sector, false);
+    }
+    ringErasedSector = -1;
+  }
+
+  // Too few empty buckets left, deleted ones are only cleared by a rebuild
+  if (ringIndex != nullptr && ringIndexUsed >= (ringIndexMask + 1) / 4 * 3) {
+    ringIndexBuild();
+  }
+
+  // Body first, then the magic byte commits it
+  RingSlot slot;
+  slot.header.magic = 0xFF;
+  slot.header.pending = RING_PENDING;
+  slot.header.version = RING_RECORD_VERSION;
+  slot.header.seq = session.seq;
+  packUUID(session.uuid, slot.record.uuid);
+  slot.record.startTime = session.startTime;
+  slot.record.flags = session.flags;
+  if (session.durationSeconds <= UINT16_MAX) {
+    slot.record.duration = session.durationSeconds;
+  } else {
+    uint32_t minutes = session.durationSeconds / 60;
+    slot.record.duration = minutes > UINT16_MAX ? UINT16_MAX : minutes;
+    slot.record.flags |= SESSION_FLAG_MINUTES;
+  }
+  const uint8_t* checked = (const uint8_t*)&slot + offsetof(RingSlotHeader, seq);
+  slot.header.crc = flashCRC(checked, sizeof(RingSlot) - offsetof(RingSlotHeader, seq));
+
+  uint32_t offset = ringSlotOffset(ringHead);
+  uint8_t magic = RING_SLOT_MAGIC;
+  bool ok = ringFlashWrite(offset, &slot, sizeof(slot)) &&
+            ringFlashWrite(offset, &magic, 1);
+  if (!ok) {
+    // The slot is spoiled either way, move past it. Should the write have
+    // landed after all, it must not read as pending: its seq is reused.
+    uint8_t acked = 0;
+    ringFlashWrite(offset + offsetof(RingSlotHeader, pending), &acked, 1);
+    ringWriteFailed(ringHead);
+    ringHead = (ringHead + 1) % ringSlotCount;
+    return false;
+  }
+
+  if (pendingSessionCount == 0) {
+    ringTail = ringHead;
+  }
+  pendingSessionCount++;
+  ringIndexInsert(slot.record.uuid, ringHead);
+  ringHead = (ringHead + 1) % ringSlotCount;
+  return true;
+}
+
+void ringAckSlot(uint32_t slot, const Session& session) {
+  // 0xFF -> 0x00 needs no erase
+  uint8_t acked = 0;
+  ringFlashWrite(ringSlotOffset(slot) + offsetof(RingSlotHeader, pending), &acked, 1);
+  ringForget(session);
+}
+
+void ringForget(const Session& session) {
+  // No longer pending, however it was acked or dropped
+  pendingSessionCount--;
+
+  uint8_t uuid[16];
+  packUUID(session.uuid, uuid);
+  ringIndexRemove(uuid);
+}
+
+void ringPrepareSector() {
+  // Space is reclaimed by erasing a whole sector as the head enters it.
+  // Done ahead of time, a session end costs only its slot write.
+  if (ringSlotCount == 0) {
+    return;
+  }
+
+  uint32_t sectorCount = ringSlotCount / RING_SLOTS_PER_SECTOR;
+  uint32_t sector = ringHead / RING_SLOTS_PER_SECTOR;
+  if (ringHead % RING_SLOTS_PER_SECTOR != 0) {
+    sector = (sector + 1) % sectorCount;
+  }
+
+  // Still holding pending sessions, or already done
+  if ((int32_t)sector == ringErasedSector ||
+      (pendingSessionCount > 0 && ringTail / RING_SLOTS_PER_SECTOR == sector)) {
+    return;
+  }
+
+  // Skip the erase if a previous boot already did it
+  if (!ringSectorErased(sector)) {
+    ringFlashErase(sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    ringSetSectorV1(sector, false);
+  }
+  ringErasedSector = sector;
+}
+
+void ringAdvanceTail() {
+  if (pendingSessionCount == 0) {
+    ringTail = ringHead;
+    return;
+  }
+  // Once round at most. The count can disagree with the slots after a
+  // failed pending-byte program or a bit flip, and the BLE task must not
+  // spin on it.
+  for (uint32_t i = 0; i < ringSlotCount; i++) {
+    if (ringSlotPending(ringTail)) {
+      return;
+    }
+    ringTail = (ringTail + 1) % ringSlotCount;
+  }
+  uint32_t lost = pendingSessionCount;
+  pendingSessionCount = 0;
+  ringTail = ringHead;
+  ringCountMismatch(lost);
+}
+
+void ringEvictTailSector() {
+  // Drop whatever is still pending from the tail to the end of its sector
+  uint32_t sectorEnd = (ringTail / RING_SLOTS_PER_SECTOR + 1) * RING_SLOTS_PER_SECTOR;
+  uint32_t dropped = 0;
+  Session session;
+  bool pending;
+  for (uint32_t i = ringTail; i < sectorEnd; i++) {
+    if (ringReadSlot(i, &session, &pending) && pending) {
+      ringForget(session);
+      dropped++;
+    }
+  }
+
+  ringTail = sectorEnd % ringSlotCount;
+  ringAdvanceTail();
+  ringOverflowed(dropped, OverflowPolicy::DROP_OLDEST);
+}
+
+// Pending sessions are indexed by UUID so an ack finds its slot in a probe
+// or two instead of scanning the ring. Buckets hold only the slot; a probe
+// confirms the UUID against flash. Acked and evicted sessions leave deleted
+// buckets behind, cleared by a rebuild from the ring when they pile up.
+
+void ringIndexBuild() {
+  if (ringIndex == nullptr) {
+    return;
+  }
+
+  memset(ringIndex, 0, (ringIndexMask + 1) * sizeof(uint16_t));
+  ringIndexUsed = 0;
+
+  Session session;
+  bool pending;
+  uint32_t span = ringSpan();
+  for (uint32_t k = 0; k < span; k++) {
+    uint32_t index = (ringTail + k) % ringSlotCount;
+    if (ringReadSlot(index, &session, &pending) && pending) {
+      uint8_t uuid[16];
+      packUUID(session.uuid, uuid);
+      ringIndexInsert(uuid, index);
+    }
+  }
+}
+
+void ringIndexInsert(const uint8_t* uuid, uint32_t slot) {
+  if (ringIndex == nullptr) {
+    return;
+  }
+
+  uint32_t bucket = ringIndexHash(uuid);
+  while (ringIndex[bucket] != RING_INDEX_EMPTY && ringIndex[bucket] != RING_INDEX_DELETED) {
+    bucket = (bucket + 1) & ringIndexMask;
+  }
+  if (ringIndex[bucket] == RING_INDEX_EMPTY) {
+    ringIndexUsed++;
+  }
+  ringIndex[bucket] = slot + 1;
+}
+
+int32_t ringIndexLookup(const uint8_t* uuid) {
+  // Bucket holding the session, or -1
+  char text[37];
+  unpackUUID(uuid, text);
+
+  Session session;
+  uint32_t bucket = ringIndexHash(uuid);
+  for (uint32_t probes = 0; probes <= ringIndexMask; probes++) {
+    uint16_t entry = ringIndex[bucket];
+    if (entry == RING_INDEX_EMPTY) {
+      return -1;
+    }
+    if (entry != RING_INDEX_DELETED &&
+        ringReadSlot(entry - 1, &session, nullptr) && strcmp(session.uuid, text) == 0) {
+      return bucket;
+    }
+    bucket = (bucket + 1) & ringIndexMask;
+  }
+  return -1;
+}
+
+void ringIndexRemove(const uint8_t* uuid) {
+  if (ringIndex == nullptr) {
+    return;
+  }
+
+  int32_t bucket = ringIndexLookup(uuid);
+  if (bucket >= 0) {
+    ringIndex[bucket] = RING_INDEX_DELETED;
+  }
+}
+
+uint32_t ringIndexHash(const uint8_t* uuid) {
+  // Version 4 UUIDs are random, mixing two words is plenty
+  uint32_t a, b;
+  memcpy(&a, uuid, sizeof(a));
+  memcpy(&b, uuid + 12, sizeof(b));
+  return ((a ^ b) * 2654435761u >> 16) & ringIndexMask;
+}
+
+// =============================================================================
+// SYNC
+// =============================================================================
+
+// The app reads pending sessions in batches that fit one read and acks each
+// batch by seq or by UUID. A connection is served onwards from sendSlot, so
+// a later read gets the next batch before the last one is confirmed; a new
+// connection goes back to the first unconfirmed session. Acks are
+// idempotent: unknown or already-acknowledged sessions are ignored, so a
+// batch acknowledged twice across a reconnect is harmless.
+
+void syncResume() {
+  // Resume from the first session the app hasn't confirmed
+  sendCursor = syncCursor;
+  sendSlot = ringTail;
+}
+
+uint32_t syncBatchStart() {
+  // Offset from the tail of the next batch. Once everything has been
+  // served, re-offer whatever is still unconfirmed.
+  if (sendCursor <= syncCursor || ringSlotCount == 0) {
+    return 0;
+  }
+  uint32_t first = (sendSlot + ringSlotCount - ringTail) % ringSlotCount;
+  return first < ringSpan() ? first : 0;
+}
+
+bool syncNext(uint32_t* offset, uint32_t* slot, Session* session) {
+  // The next pending session at or after offset, which moves past it
+  bool pending;
+  uint32_t span = ringSpan();
+  while (*offset < span) {
+    uint32_t index = (ringTail + *offset) % ringSlotCount;
+    (*offset)++;
+    if (ringReadSlot(index, session, &pending) && pending) {
+      *slot = index;
+      return true;
+    }
+  }
+  return false;
+}
+
+void syncServed(uint32_t slot, const Session& session) {
+  sendCursor = session.seq + 1;
+  sendSlot = (slot + 1) % ringSlotCount;
+}
+
+bool ackSessionsUpTo(uint32_t upTo) {
+  // The batch is acked by raising the high-water mark, one journal field,
+  // rather than a write per slot. Never past what has been recorded.
+  if (upTo >= nextSessionSeq) {
+    upTo = nextSessionSeq - 1;
+  }
+  if (upTo <= ringAckedUpTo) {
+    return false;
+  }
+
+  // Seqs increase from the tail, so stop at the first one past upTo
+  Session session;
+  bool pending;
+  uint32_t span = ringSpan();
+  for (uint32_t k = 0; k < span; k++) {
+    uint32_t index = (ringTail + k) % ringSlotCount;
+    if (!ringReadSlot(index, &session, &pending)) {
+      continue;
+    }
+    if (session.seq > upTo) {
+      break;
+    }
+    if (pending) {
+      ringForget(session);
+    }
+  }
+
+  ringAckedUpTo = upTo;
+  return true;
+}
+
+bool ackSession(const char* uuid) {
+  // True if the session was pending until now
+  Session session;
+  bool pending;
+
+  if (ringIndex != nullptr) {
+    uint8_t key[16];
+    packUUID(uuid, key);
+    int32_t bucket = ringIndexLookup(key);
+    if (bucket >= 0) {
+      uint32_t index = ringIndex[bucket] - 1;
+      if (ringReadSlot(index, &session, &pending) && pending) {
+        ringAckSlot(index, session);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // No room for the index, search the ring
+  uint32_t span = ringSpan();
+  for (uint32_t k = 0; k < span; k++) {
+    uint32_t index = (ringTail + k) % ringSlotCount;
+    if (ringReadSlot(index, &session, &pending) && strcasecmp(session.uuid, uuid) == 0) {
+      if (pending) {
+        ringAckSlot(index, session);
+      }
+      return pending;
+    }
+  }
+  return false;
+}
+
+void syncAcked() {
+  // After a batch of acks the tail and cursor catch up
+  ringAdvanceTail();
+  updateSyncCursor();
+}
+
+void updateSyncCursor() {
+  // The tail is the oldest pending session
+  Session session;
+  if (pendingSessionCount > 0 && ringReadSlot(ringTail, &session, nullptr)) {
+    syncCursor = session.seq;
+  } else {
+    syncCursor = nextSessionSeq;
+  }
+}
+
+void packUUID(const char* in, uint8_t* out) {
+  // 36-character text form to 16 bytes, dashes skipped
+  memset(out, 0, 16);
+  int nibble = 0;
+  for (const char* c = in; *c != '\0' && nibble < 32; c++) {
+    uint8_t value;
+    if (*c >= '0' && *c <= '9') {
+      value = *c - '0';
+    } else if (*c >= 'a' && *c <= 'f') {
+      value = *c - 'a' + 10;
+    } else if (*c >= 'A' && *c <= 'F') {
+      value = *c - 'A' + 10;
+    } else {
+      continue;
+    }
+    out[nibble / 2] |= (nibble % 2 == 0) ? value << 4 : value;
+    nibble++;
+  }
+}
+
+void unpackUUID(const uint8_t* in, char* out) {
+  snprintf(out, 37,
+           "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+           in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7],
+           in[8], in[9], in[10], in[11], in[12], in[13], in[14], in[15]);
+}
@@ -0,0 +1,190 @@
+/**
+ * Meditation Band Session Ring
+ *
+ * Pending sessions on their own flash partition, the UUID index that finds
+ * them for acks, and the sync cursor the app resumes from.
+ *
+ * Free of Arduino and ESP-IDF so it also builds on the host for tests
+ * (pio test -e native). The firmware supplies flash access, the CRC and
+ * overflow reporting through the hooks at the end. Not thread-safe: callers
+ * hold the ring mutex.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// =============================================================================
+// CONSTANTS
+// =============================================================================
+
+#define FLASH_SECTOR_SIZE      4096
+#define RING_SLOT_MAGIC        0x5E
+#define RING_RECORD_VERSION    2      // Packed records, 0xFF marks version 1
+#define RING_MAX_SECTORS       128    // 16384 slots, still within a UUID index bucket
+#define RING_INDEX_EMPTY       0x0000 // UUID index buckets hold slot + 1
+#define RING_INDEX_DELETED     0xFFFF
+#define RING_PENDING           0xFF   // Pending byte until acknowledged
+#ifndef RING_OVERFLOW_POLICY
+#define RING_OVERFLOW_POLICY   OverflowPolicy::DROP_OLDEST  // Or DROP_NEWEST
+#endif
+
+// =============================================================================
+// RECORDS
+// =============================================================================
+
+// Session as handled in RAM, packed into a SessionRecord in the ring
+#define SESSION_FLAG_RECOVERED   0x01  // Closed from a checkpoint after power loss
+#define SESSION_FLAG_MINUTES     0x80  // Record duration in minutes (flash only)
+
+struct Session {
+  char uuid[37];
+  uint8_t flags;            // SESSION_FLAG_*
+  uint32_t seq;             // Monotonic, assigned when recorded
+  uint32_t startTime;
+  uint32_t endTime;
+  uint32_t durationSeconds;
+};
+
+enum class OverflowPolicy : uint8_t {
+  DROP_OLDEST,   // Erase the oldest sector's sessions to make room
+  DROP_NEWEST    // Keep what is stored, discard new sessions until a sync
+};
+
+// Each slot carries its session's seq, which is monotonic across the ring,
+// and a 16-bit check rather than a full CRC32: two more bytes per slot
+// would break the 32-byte tiling below. A torn slot is caught by its magic,
+// written last, before the CRC is consulted, so the CRC only has to catch
+// bit rot in a committed slot, where a 1 in 65536 miss is accepted.
+struct __attribute__((packed)) RingSlotHeader {
+  uint8_t magic;             // Written last, marks the slot committed
+  uint8_t pending;           // RING_PENDING until acked, then programmed to 0
+  uint8_t version;           // RING_RECORD_VERSION
+  uint16_t crc;              // Low half of the CRC32 of seq and record
+  uint32_t seq;              // Monotonic, assigned when recorded
+};
+
+// End time is implied by start plus duration; sessions over 18 hours are
+// kept to the minute with SESSION_FLAG_MINUTES
+struct __attribute__((packed)) SessionRecord {
+  uint8_t uuid[16];          // Binary UUID
+  uint32_t startTime;        // Unix seconds, or seconds since that boot
+  uint16_t duration;         // Seconds, or minutes with SESSION_FLAG_MINUTES
+  uint8_t flags;             // SESSION_FLAG_*
+};
+
+struct __attribute__((packed)) RingSlot {
+  RingSlotHeader header;
+  SessionRecord record;
+};
+
+// Flash cost per session is the slot, not the record: the 9-byte header
+// that commits, acks and checks it brings the 23-byte record to 32, which
+// tiles a sector. A 24-byte slot would need a 1-byte header.
+static_assert(sizeof(SessionRecord) < 24, "Session records must stay compact");
+static_assert(sizeof(RingSlot) == 32, "Ring slots are 32 bytes per session");
+static_assert(FLASH_SECTOR_SIZE % sizeof(RingSlot) == 0, "Ring slots must tile a sector");
+#define RING_SLOTS_PER_SECTOR  (FLASH_SECTOR_SIZE / sizeof(RingSlot))
+
+// Version 1 slots, unversioned raw structs. Sectors still holding them are
+// read in place until the head wraps round and erases them.
+struct RingSlotV1 {
+  uint8_t magic;
+  uint8_t pending;
+  uint16_t reserved;         // 0xFFFF, where version now sits
+  uint32_t crc;              // CRC32 of the session
+  struct {
+    char uuid[37];
+    uint8_t flags;
+    uint32_t seq;
+    uint32_t startTime;
+    uint32_t endTime;
+    uint32_t durationSeconds;
+  } session;
+};
+
+static_assert(sizeof(RingSlotV1) == 64, "Version 1 slot layout is fixed");
+static_assert(RING_MAX_SECTORS * RING_SLOTS_PER_SECTOR < RING_INDEX_DELETED,
+              "Slots must fit a UUID index bucket");
+#define RING_V1_SLOTS_PER_SECTOR  (FLASH_SECTOR_SIZE / sizeof(RingSlotV1))
+
+// =============================================================================
+// STATE
+// =============================================================================
+
+extern uint32_t ringSlotCount;       // 0 until mounted
+extern uint32_t ringV1Sectors[RING_MAX_SECTORS / 32];  // Bit per sector still in version 1 layout
+extern uint32_t ringHead;            // Next slot to write
+extern uint16_t* ringIndex;          // Pending sessions by UUID, open addressing
+extern uint32_t ringIndexMask;
+extern uint32_t ringIndexUsed;       // Buckets not empty, deleted included
+extern uint32_t ringTail;            // Oldest pending slot, == ringHead when none
+extern uint32_t ringAckedUpTo;       // Every seq up to this is acked (journaled)
+extern int32_t ringErasedSector;     // Erased ahead of the head while idle
+extern int pendingSessionCount;
+
+// Sync progress. Every session with seq < syncCursor has been acknowledged
+// (the seq at the ring tail, so it survives reboots); sendCursor is how far
+// this connection has been served and sendSlot is where that is in the ring.
+extern uint32_t nextSessionSeq;
+extern uint32_t syncCursor;
+extern uint32_t sendCursor;
+extern uint32_t sendSlot;
+
+// =============================================================================
+// SESSION RING
+// =============================================================================
+
+bool ringMount(uint32_t partitionSize);
+bool ringAppend(const Session& session);
+bool ringSectorFirst(uint32_t sector, Session* first);
+bool ringSectorV1(uint32_t sector);
+void ringSetSectorV1(uint32_t sector, bool v1);
+uint32_t ringV1SectorCount();
+bool ringReadSlot(uint32_t slot, Session* out, bool* pending);
+bool ringReadSlotV1(uint32_t slot, Session* out, bool* pending);
+bool ringSlotPending(uint32_t slot);
+bool ringSlotErased(uint32_t slot);
+bool ringSectorErased(uint32_t sector);
+size_t ringSlotOffset(uint32_t slot);
+void ringAckSlot(uint32_t slot, const Session& session);
+void ringForget(const Session& session);
+void ringPrepareSector();
+void ringIndexBuild();
+void ringIndexInsert(const uint8_t* uuid, uint32_t slot);
+int32_t ringIndexLookup(const uint8_t* uuid);
+void ringIndexRemove(const uint8_t* uuid);
+uint32_t ringIndexHash(const uint8_t* uuid);
+void ringAdvanceTail();
+void ringEvictTailSector();
+uint32_t ringSpan();
+
+// =============================================================================
+// SYNC
+// =============================================================================
+
+void syncResume();
+uint32_t syncBatchStart();
+bool syncNext(uint32_t* offset, uint32_t* slot, Session* session);
+void syncServed(uint32_t slot, const Session& session);
+bool ackSessionsUpTo(uint32_t upTo);
+bool ackSession(const char* uuid);
+void syncAcked();
+void updateSyncCursor();
+void packUUID(const char* in, uint8_t* out);
+void unpackUUID(const uint8_t* in, char* out);
+
+// =============================================================================
+// HOOKS
+// =============================================================================
+
+// Supplied by the firmware, or by the host test harness. Offsets are from
+// the start of the sessions partition.
+bool ringFlashRead(uint32_t offset, void* data, size_t length);
+bool ringFlashWrite(uint32_t offset, const void* data, size_t length);
+bool ringFlashErase(uint32_t offset, size_t length);
+uint32_t flashCRC(const void* data, size_t length);        // CRC32, as crc32_le(0, ...)
+void ringOverflowed(uint32_t dropped, OverflowPolicy policy);
+void ringWriteFailed(uint32_t slot);
+void ringCountMismatch(uint32_t counted);                  // Counted pending, none found
@@ -18,9 +18,16 @@
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
-#include <FastLED.h>
 #include <ArduinoJson.h>
 #include <Preferences.h>
+#include <esp_timer.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <driver/rmt.h>
+#include <rom/crc.h>
+#include <SessionRing.h>
+#include <SessionJournal.h>
+#include <BreathCurve.h>
 
 // =============================================================================
 // PIN DEFINITIONS
@@ -35,6 +42,12 @@
 // CONSTANTS
 // =============================================================================
 
+// Versions (reported on the capabilities characteristic)
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION       "1.1.0"
+#endif
+#define PROTOCOL_VERSION       2      // 1 = original Pi timer protocol
+
 // BLE UUIDs (same as Pi timer for app compatibility)
 #define SERVICE_UUID           "10000001-0000-1000-8000-00805f9b34fb"
 #define CHAR_HOURS_UUID        "10000002-0000-1000-8000-00805f9b34fb"
@@ -43,6 +56,12 @@
 #define CHAR_PLANS_UUID        "10000005-0000-1000-8000-00805f9b34fb"
 #define CHAR_ACK_UUID          "10000006-0000-1000-8000-00805f9b34fb"
 #define CHAR_TOTAL_UUID        "10000007-0000-1000-8000-00805f9b34fb"
+#define CHAR_TIME_UUID         "10000008-0000-1000-8000-00805f9b34fb"
+#define CHAR_DIAG_UUID         "10000009-0000-1000-8000-00805f9b34fb"
+#define CHAR_CAPS_UUID         "1000000a-0000-1000-8000-00805f9b34fb"
+#define CHAR_PATTERN_UUID      "1000000b-0000-1000-8000-00805f9b34fb"
+#define CHAR_BREATH_SYNC_UUID  "1000000c-0000-1000-8000-00805f9b34fb"
+#define CHAR_HAPTIC_UUID       "1000000d-0000-1000-8000-00805f9b34fb"
 
 // Timing
 #define BREATH_CYCLE_MS        8000   // 8 second breath cycle
@@ -52,15 +71,92 @@
 #define MOTOR_PAUSE_MS         200    // Pause between pulses
 #define COMPLETION_GLOW_MS     30000  // How long LED glows after completion
 #define GOAL_APPROACH_MS       120000 // 2 minutes before goal, start brightening
+#define CHECKPOINT_RTC_MS      1000   // Active session copy in RTC memory
+#define CHECKPOINT_FLASH_MS    30000  // And in flash, for power loss
+#define RTC_CHECKPOINT_MAGIC   0x43505452  // "RTPC"
 
 // LED
 #define NUM_LEDS               1
-#define LED_BRIGHTNESS_MAX     50     // Max brightness (0-255)
-#define LED_BRIGHTNESS_MIN     5      // Min brightness during breath
-
-// Storage
-#define MAX_PENDING_SESSIONS   50
+#define LED_BRIGHTNESS_MAX     131    // Max lightness (0-255), 50/255 duty
+#define LED_BRIGHTNESS_MIN     39     // Min lightness during breath, 5/255 duty
+#define COLOR_WARM             0xFFFFE6  // Soft white for breathing
+#define COLOR_WHITE            0xFFFFFF
+#define PATTERN_NO_LOOP        0xFF
+#define PATTERN_FORMAT         1      // Uploaded pattern format version
+#define PATTERN_MAX_KEYFRAMES  16
+#define PATTERN_HEADER_BYTES   6
+#define PATTERN_KEYFRAME_BYTES 7
+#define PATTERN_MAX_BYTES      (PATTERN_HEADER_BYTES + PATTERN_MAX_KEYFRAMES * PATTERN_KEYFRAME_BYTES)
+#define BREATH_SLEW_MS_PER_S   50     // Phase correction rate, 5% of real time
+#define BREATH_RATE_SPACING_MS 30000  // Shortest sync interval that updates the rate
+#define BREATH_RATE_GAIN       32     // Rate takes 1/32 of the implied correction
+#define BREATH_MAX_RATE_PPM    500
+#define LED_RMT_CHANNEL        RMT_CHANNEL_0
+#define LED_RMT_CLK_DIV        2      // 80 MHz APB / 2, 25 ns ticks
+#define WS2812_T0H_TICKS       16     // 0 bit: 0.40 us high
+#define WS2812_T0L_TICKS       34     //        0.85 us low
+#define WS2812_T1H_TICKS       32     // 1 bit: 0.80 us high
+#define WS2812_T1L_TICKS       18     //        0.45 us low
+#define WS2812_LATCH_TICKS     12000  // 300 us low latches the frame
+#define LED_FRAME_ITEMS        (NUM_LEDS * 24 + 1)  // A bit per item, then the latch
+#define LED_CHANNEL_UA         12000  // Per colour channel at full duty
+
+// Haptics
+#define MOTOR_LEDC_CHANNEL     0
+#define MOTOR_PWM_HZ           20000  // Above hearing
+#define MOTOR_PWM_BITS         8
+#define MOTOR_DUTY_FULL        255
+#define MOTOR_CURRENT_UA       60000  // Running at full duty
+#define HAPTIC_TICK_MS         24     // Breath phase tick in haptic guidance
+#define HAPTIC_TICK_DUTY       160    // About 2.1 V, keeps it turning once kicked
+#define HAPTIC_STALL_DUTY      180    // Least duty that starts it from rest
+#define HAPTIC_KICK_MS         10     // Full duty to spin it up, unless a pattern sets its own
+#define HAPTIC_MAX_KICK_MS     50
+#define HAPTIC_RAMP_STEP_MS    5      // Duty update interval along a ramp
+#define HAPTIC_FORMAT          1      // Uploaded haptic pattern format version
+#define HAPTIC_MAX_STEPS       16
+#define HAPTIC_HEADER_BYTES    4
+#define HAPTIC_STEP_BYTES      4
+#define HAPTIC_MAX_BYTES       (HAPTIC_HEADER_BYTES + HAPTIC_MAX_STEPS * HAPTIC_STEP_BYTES)
+#define HAPTIC_MAX_MS          10000  // Longest an uploaded pattern may play
+#define MAX_BELL_TIMES         8      // One-off bells a plan can add to the interval
+#define BELL_MIN_INTERVAL_S    10
+#define GOAL_BELL_QUIET_MS     1000   // Bells this soon after the goal are left to its pulses
+
+// Storage (session ring layout in SessionRing.h)
+#define RING_PARTITION         "sessions"
+#define NVS_MAX_SESSIONS       50     // Limit of the pre-journal NVS list
 #define PREFS_NAMESPACE        "medband"
+#define JOURNAL_PARTITION      "journal"
+#define STORAGE_QUIET_MS       2000   // Coalesce state changes for this long
+#define DIRTY_PLAN             0x01   // Cached state fields awaiting a commit
+#define DIRTY_TOTAL            0x02
+#define DIRTY_DROPPED          0x04
+#define DIRTY_CHECKPOINT       0x08
+#define DIRTY_ACKED            0x10
+#define DIRTY_WEAR             0x20   // Flash wear outside the journal
+#define TRACE_PARTITION        "trace"
+#define STATS_PARTITION        "stats"
+#define LOG_RECORD_MAGIC       0x6C
+#define LOG_MAX_RECORD         64
+#define TRACE_BOOT_DUMP        16     // Latest events printed at boot
+
+// BLE buffers (ATT caps a characteristic value at 512 bytes)
+#define BLE_MAX_MTU            517    // Largest ATT MTU the band accepts
+#define SESSIONS_BUFFER_SIZE   512
+#define DIAG_BUFFER_SIZE       512    // One page, see DiagPage
+#define CAPS_BUFFER_SIZE       512
+#define JSON_ARENA_SIZE        4096
+
+static_assert(SESSIONS_BUFFER_SIZE <= 512 && DIAG_BUFFER_SIZE <= 512 && CAPS_BUFFER_SIZE <= 512,
+              "Bluedroid keeps the old value if a read is over 512 bytes");
+
+// Clock
+#define MIN_VALID_EPOCH        1704067200UL // 2024-01-01, rejects unset phone clocks
+#define MAX_CLOCK_REBASES      4       // Pre-sync session ranges remembered
+#define MAX_TIME_SYNCS         8       // Syncs kept for drift regression
+#define MIN_SYNC_SPACING_MS    600000  // 10 minutes between regression points
+#define SYNC_JITTER_MS         50      // Assumed BLE write latency jitter
 
 // =============================================================================
 // STATE MACHINE
@@ -83,13 +179,36 @@ uint32_t sessionDuration = 0;
 uint32_t totalSeconds = 0;
 uint32_t goalDuration = 0;          // If > 0, session has a goal
 bool goalReached = false;
+uint32_t sessionStartEpoch = 0;     // Unix seconds, 0 until the clock is known
+
+// Active session checkpoint. The RTC copy survives watchdog, brownout and
+// software resets, the flash copy (in the journal state) survives power loss.
+#define CHECKPOINT_ACTIVE        0x01
+#define CHECKPOINT_GOAL_REACHED  0x02
+
+struct SessionCheckpoint {
+  uint32_t startEpoch;      // Unix seconds, 0 if the clock wasn't set
+  uint32_t elapsedMs;       // Session time when taken
+  uint32_t goalMs;          // Goal from the plan linked at start, 0 = none
+  uint32_t flags;           // CHECKPOINT_*
+};
+
+struct RtcCheckpoint {
+  uint32_t magic;
+  SessionCheckpoint checkpoint;
+  uint32_t crc;
+};
+
+RTC_NOINIT_ATTR RtcCheckpoint rtcCheckpoint;
+SessionCheckpoint flashCheckpoint = {0, 0, 0, 0};
+uint32_t lastRtcCheckpoint = 0;
+uint32_t lastFlashCheckpoint = 0;
 
 // Touch state
 bool lastSqueezeState = false;
 uint32_t squeezeStartTime = 0;
 
 // LED
-CRGB leds[NUM_LEDS];
 uint32_t lastLedUpdate = 0;
 
 // BLE
@@ -100,13 +219,45 @@ BLECharacteristic* pSessionsChar = nullptr;
 BLECharacteristic* pPlansChar = nullptr;
 BLECharacteristic* pAckChar = nullptr;
 BLECharacteristic* pTotalChar = nullptr;
+BLECharacteristic* pTimeChar = nullptr;
+BLECharacteristic* pDiagChar = nullptr;
+BLECharacteristic* pCapsChar = nullptr;
+BLECharacteristic* pPatternChar = nullptr;
+BLECharacteristic* pBreathSyncChar = nullptr;
+BLECharacteristic* pHapticChar = nullptr;
 bool deviceConnected = false;
 
-// Storage
+// Wall clock: anchored at the last sync, extrapolated with the drift estimate
+bool clockSynced = false;
+uint64_t anchorMonoMs = 0;
+uint64_t anchorEpochMs = 0;
+
+// Time sync history for drift regression (this boot's monotonic clock only)
+struct TimeSync {
+  uint64_t monoMs;
+  int64_t offsetMs;   // epoch ms - monotonic ms at the sync
+};
+
+TimeSync timeSyncs[MAX_TIME_SYNCS];
+int timeSyncCount = 0;
+int32_t driftPpb = 0;              // Clock rate error, parts per billion
+int32_t driftUncertaintyPpb = -1;  // 1-sigma, -1 until estimated
+int32_t lastSyncErrorMs = 0;       // Predicted minus actual time at last sync
+
+// Storage (NVS for small settings, own partitions for sessions and state)
 Preferences preferences;
 
-// Session storage (simple in-memory + flash)
-struct Session {
+// Layouts of the session list older firmware kept in NVS
+struct NvsSession {
+  char uuid[37];
+  uint32_t seq;
+  uint32_t startTime;
+  uint32_t endTime;
+  uint32_t durationSeconds;
+  bool synced;
+};
+
+struct LegacySession {      // Before sessions carried a sequence number
   char uuid[37];
   uint32_t startTime;
   uint32_t endTime;
@@ -114,8 +265,79 @@ struct Session {
   bool synced;
 };
 
-Session pendingSessions[MAX_PENDING_SESSIONS];
-int pendingSessionCount = 0;
+// Session ring (SessionRing.h), the partition and lock are the firmware's
+const esp_partition_t* ringPartition = nullptr;
+SemaphoreHandle_t ringMutex = nullptr;
+uint32_t sessionsDropped = 0;      // Unsynced sessions lost to overflow
+
+// Sessions recorded before the clock was set carry seconds since boot. The
+// first sync of that boot records the offset for their seq range instead of
+// rewriting their slots.
+struct ClockRebase {
+  uint32_t firstSeq;
+  uint32_t lastSeq;
+  int64_t offsetMs;          // Epoch ms minus monotonic ms for that boot
+};
+
+ClockRebase clockRebases[MAX_CLOCK_REBASES];
+int clockRebaseCount = 0;
+uint32_t bootFirstSeq = 1;         // First seq recorded this boot
+
+// Record logs: fixed-size records written round-robin through a partition,
+// for data that is only ever appended (see RECORD LOGS)
+struct __attribute__((packed)) LogRecordHeader {
+  uint8_t magic;             // Written last, marks the record committed
+  uint8_t type;
+  uint16_t crc;              // Low half of the CRC32 of seq and payload
+  uint32_t seq;
+};
+
+struct LogRegion {
+  const char* label;
+  uint16_t recordSize;       // Header included, divides a sector
+  const esp_partition_t* partition;
+  uint32_t recordCount;
+  uint32_t head;             // Next record to write
+  uint32_t nextSeq;
+};
+
+// Diagnostic trace, the last few thousand notable events
+enum class TraceEvent : uint8_t {
+  BOOT = 1,                  // arg: esp_reset_reason_t
+  SESSION_RESUMED = 2,       // arg: elapsed seconds
+  SESSION_RECOVERED = 3,     // arg: duration seconds
+  RING_OVERFLOW = 4,         // arg: sessions dropped
+  RING_WRITE_FAILED = 5,     // arg: slot
+  CLOCK_SYNC = 6,            // arg: error against the app in ms
+  BELL = 7,                  // arg: late by this many us (int32)
+  RING_COUNT_MISMATCH = 8    // arg: sessions counted pending, none found
+};
+
+struct TraceRecord {
+  uint32_t uptimeMs;
+  uint32_t arg;
+};
+
+// Lifetime device statistics, the latest record is current
+struct DeviceStats {
+  uint32_t boots;
+  uint32_t abnormalResets;   // Panic, watchdog or brownout
+  uint32_t sessionsRecorded;
+  uint32_t sessionsResumed;
+  uint32_t sessionsRecovered;
+  uint32_t longestSessionSeconds;
+};
+
+LogRegion traceLog = {TRACE_PARTITION, sizeof(LogRecordHeader) + sizeof(TraceRecord), nullptr, 0, 0, 1};
+LogRegion statsLog = {STATS_PARTITION, sizeof(LogRecordHeader) + sizeof(DeviceStats), nullptr, 0, 0, 1};
+DeviceStats deviceStats = {0, 0, 0, 0, 0, 0};
+SemaphoreHandle_t logMutex = nullptr;  // Both logs, trace() is also called from the BLE task
+
+static_assert(FLASH_SECTOR_SIZE % (sizeof(LogRecordHeader) + sizeof(TraceRecord)) == 0,
+              "Trace records must tile a sector");
+static_assert(FLASH_SECTOR_SIZE % (sizeof(LogRecordHeader) + sizeof(DeviceStats)) == 0 &&
+              sizeof(LogRecordHeader) + sizeof(DeviceStats) <= LOG_MAX_RECORD,
+              "Stats records must tile a sector");
 
 // Plan storage
 struct Plan {
@@ -125,7 +347,476 @@ struct Plan {
   bool active;
 };
 
+// How a session guides the breath, chosen by the plan
+enum class Guidance : uint8_t {
+  LIGHT,                     // Breathing light on the LED
+  HAPTIC                     // LED off, a motor tick at each breath phase
+};
+
+const char* const GUIDANCE_NAMES[] = {"light", "haptic"};
+constexpr int GUIDANCE_COUNT = sizeof(GUIDANCE_NAMES) / sizeof(GUIDANCE_NAMES[0]);
+
+// Interval bells, in seconds from the session start
+struct BellSchedule {
+  uint16_t everySeconds;     // Repeating interval, 0 = none
+  uint8_t count;             // One-off bells in atSeconds
+  uint8_t reserved;
+  uint16_t atSeconds[MAX_BELL_TIMES];
+};
+
+struct BellStats {
+  uint32_t fired;            // Since boot
+  int32_t lastErrorUs;       // Motor start minus deadline
+  int32_t maxErrorUs;
+  int64_t sumErrorUs;
+};
+
 Plan todaysPlan = {0, 0, false, false};
+uint8_t sessionPattern = 0;  // Index into PATTERNS, chosen by the plan
+Guidance sessionGuidance = Guidance::LIGHT;
+BellSchedule bellSchedule = {0, 0, 0, {}};
+
+// Bell timing (see INTERVAL BELLS)
+esp_timer_handle_t bellTimer = nullptr;
+int64_t bellBaseUs = 0;            // esp_timer time at session start
+int64_t bellDeadlineUs = INT64_MAX; // Next bell, INT64_MAX outside a session
+BellStats bellStats = {0, 0, 0, 0};
+volatile bool bellTracePending = false;
+volatile int32_t bellTraceErrorUs = 0;
+
+// LED animation (see LED CONTROL)
+enum class Easing : uint8_t {
+  STEP,                      // Jump to the keyframe as its segment starts
+  LINEAR,
+  SINE                       // Ease in and out along the breath curve
+};
+
+struct Keyframe {
+  uint32_t color;            // 0xRRGGBB
+  uint16_t durationMs;       // Time to reach this keyframe from the previous
+  uint8_t level;             // Brightness, 0-255
+  Easing easing;
+};
+
+struct Pattern {
+  const char* name;
+  const Keyframe* keyframes;
+  uint8_t count;
+  uint8_t loopStart;         // Repeat from here, PATTERN_NO_LOOP holds the last
+};
+
+const Pattern* ledPattern = nullptr;
+uint32_t ledPatternStart = 0;
+uint8_t ledSegment = 0;         // Keyframe being approached, set by renderPattern
+uint32_t ledShown = 0;          // Last frame sent, 0xRRGGBB
+uint8_t ledDither[3] = {0, 0, 0};  // Carried sub-LSB remainder per channel
+SemaphoreHandle_t ledMutex = nullptr;
+
+// LED driver (see LED DRIVER)
+struct LedStats {
+  uint32_t frames;           // Frames handed to the RMT
+  uint32_t busy;             // Frames dropped while the last was still going out
+  uint64_t sendUs;           // CPU time spent queueing frames
+  uint32_t maxSendUs;
+  uint32_t updates;          // Calls to updateLED
+  uint64_t updateUs;         // CPU time in them, sending included
+  uint32_t maxUpdateUs;
+};
+
+rmt_item32_t ledItems[LED_FRAME_ITEMS];
+volatile bool ledBusy = false;
+LedStats ledStats = {0, 0, 0, 0, 0, 0, 0};
+
+// Haptic patterns (see HAPTIC FEEDBACK)
+enum class HapticOp : uint8_t {
+  SET,                       // Drive at the amplitude for the duration
+  RAMP,                      // Move from the present amplitude to this one
+  LOOP                       // Go back to step `amplitude`, `durationMs` more times
+};
+
+struct HapticStep {
+  HapticOp op;
+  uint8_t amplitude;         // Motor duty, 0-255
+  uint16_t durationMs;
+};
+
+struct HapticPattern {
+  const HapticStep* steps;
+  uint8_t count;
+  uint8_t kickMs;            // Full duty before a step from rest, 0 for HAPTIC_KICK_MS
+};
+
+// What the band buzzes for. Each has a built-in pattern the app can replace.
+enum class HapticEvent : uint8_t {
+  START,
+  GOAL,
+  END,
+  REMINDER,
+  LOW_BATTERY,
+  BELL,
+  TICK,                      // Breath phase in haptic guidance
+  COUNT
+};
+
+constexpr int HAPTIC_EVENT_COUNT = (int)HapticEvent::COUNT;
+const char* const HAPTIC_EVENT_NAMES[HAPTIC_EVENT_COUNT] = {
+  "start", "goal", "end", "reminder", "lowBattery", "bell", "tick"};
+
+esp_timer_handle_t hapticTimer = nullptr;
+SemaphoreHandle_t hapticMutex = nullptr;
+const HapticPattern* hapticPattern = nullptr;  // Playing, or nullptr
+uint8_t hapticIndex = 0;           // Step being played
+uint32_t hapticStepMs = 0;         // Time into it
+uint8_t hapticRampFrom = 0;
+uint32_t hapticLoops[HAPTIC_MAX_STEPS];  // Passes left + 1 per LOOP step, 0 = not entered
+int64_t hapticDueUs = 0;           // When the timer should next fire
+uint32_t motorDuty = 0;
+HapticEvent hapticEvent = HapticEvent::START;  // Event of the pattern playing
+uint64_t hapticStartUaMs = 0;      // Motor charge when it began
+uint8_t breathSegment = PATTERN_NO_LOOP;  // Breath keyframe last ticked for
+
+// Modelled motor charge per play of each event
+struct HapticStats {
+  uint32_t plays;
+  uint64_t uaMs;
+  uint32_t lastUaMs;
+};
+
+HapticStats hapticStats[HAPTIC_EVENT_COUNT] = {};
+
+// Patterns uploaded by the app, a count of 0 plays the built-in
+HapticStep customHapticSteps[HAPTIC_EVENT_COUNT][HAPTIC_MAX_STEPS];
+HapticPattern customHaptics[HAPTIC_EVENT_COUNT];
+
+// Modelled output current integrated over time, so each guidance mode's
+// cost can be compared. The MCU and radio draw the same in both.
+struct ChargeMeter {
+  uint64_t uaMs;             // Charge up to since
+  uint32_t ua;               // Present draw
+  uint32_t since;            // millis() of the last change
+};
+
+struct GuidanceEnergy {
+  uint32_t sessions;
+  uint64_t sessionMs;
+  uint64_t ledUaMs;
+  uint64_t motorUaMs;
+};
+
+ChargeMeter ledMeter = {0, 0, 0};
+ChargeMeter motorMeter = {0, 0, 0};
+GuidanceEnergy guidanceEnergy[GUIDANCE_COUNT] = {};
+uint32_t sessionMeterStart = 0;   // When the session began, and the meters then
+uint64_t sessionLedUaMs = 0;
+uint64_t sessionMotorUaMs = 0;
+
+// Pattern uploaded by the app, kept as sent for reads and NVS
+Keyframe customKeys[PATTERN_MAX_KEYFRAMES];
+Pattern customPattern = {"custom", customKeys, 0, PATTERN_NO_LOOP};
+uint8_t customPatternBytes[PATTERN_MAX_BYTES];
+size_t customPatternLength = 0;
+
+// Breath phase lock to the app's breath clock (see BREATH SYNC)
+struct BreathClock {
+  bool locked;
+  uint32_t cycleMs;          // The app's breath cycle
+  uint64_t refEpochMs;       // Wall clock time at which one of its cycles began
+  int64_t appTimeUs;         // Estimated app breath time since refEpochMs
+  uint32_t advancedMs;       // millis() appTimeUs was last advanced to
+  int64_t slewUs;            // Phase correction still to apply
+  int32_t ratePpm;           // App breath time gained per band second
+  uint32_t lastSyncMs;
+  uint32_t syncs;            // Since the lock was acquired
+  int32_t lastErrorMs;       // Phase error found at the latest sync
+  int32_t maxErrorMs;        // Largest since the lock was acquired
+};
+
+BreathClock breathClock = {};
+
+// The breath curve and the TABLE_256 expander are in BreathCurve.h
+
+// Perceived lightness to LED duty in Q16, along CIE 1976 L*. Patterns work
+// in lightness so fades look even; the one extra entry ends interpolation.
+constexpr uint16_t gammaStep(int i) {
+  return (uint16_t)(65535 * (i * 100.0 / 255 > 8
+    ? ((i * 100.0 / 255 + 16) / 116) * ((i * 100.0 / 255 + 16) / 116) * ((i * 100.0 / 255 + 16) / 116)
+    : i * 100.0 / 255 / 903.3) + 0.5);
+}
+
+constexpr uint16_t GAMMA_TABLE[257] = {TABLE_256(gammaStep), 65535};
+
+static_assert(GAMMA_TABLE[0] == 0 && GAMMA_TABLE[255] == 65535, "Gamma must run from off to full");
+
+// Pattern library. Each keyframe is reached from the one before it; a
+// looping pattern reaches its loop start from its last keyframe.
+#define PATTERN(name, keys, loopStart) {name, keys, sizeof(keys) / sizeof(Keyframe), loopStart}
+
+constexpr Keyframe BREATH_KEYS[] = {
+  {COLOR_WARM, BREATH_CYCLE_MS / 2, LED_BRIGHTNESS_MAX, Easing::SINE},   // In
+  {COLOR_WARM, BREATH_CYCLE_MS / 2, LED_BRIGHTNESS_MIN, Easing::SINE},   // Out
+};
+
+constexpr Keyframe BOX_KEYS[] = {
+  {COLOR_WARM, 4000, LED_BRIGHTNESS_MAX, Easing::SINE},                  // In
+  {COLOR_WARM, 4000, LED_BRIGHTNESS_MAX, Easing::LINEAR},                // Hold
+  {COLOR_WARM, 4000, LED_BRIGHTNESS_MIN, Easing::SINE},                  // Out
+  {COLOR_WARM, 4000, LED_BRIGHTNESS_MIN, Easing::LINEAR},                // Hold
+};
+
+constexpr Keyframe RELAX_478_KEYS[] = {
+  {COLOR_WARM, 4000, LED_BRIGHTNESS_MAX, Easing::SINE},                  // In
+  {COLOR_WARM, 7000, LED_BRIGHTNESS_MAX, Easing::LINEAR},                // Hold
+  {COLOR_WARM, 8000, LED_BRIGHTNESS_MIN, Easing::SINE},                  // Out
+};
+
+constexpr Keyframe COHERENT_KEYS[] = {
+  {COLOR_WARM, 2750, LED_BRIGHTNESS_MAX, Easing::SINE},                  // In
+  {COLOR_WARM, 2750, LED_BRIGHTNESS_MIN, Easing::SINE},                  // Out
+};
+
+constexpr Keyframe START_KEYS[] = {
+  {COLOR_WHITE, 100, LED_BRIGHTNESS_MAX, Easing::STEP},
+};
+
+constexpr Keyframe GLOW_KEYS[] = {
+  {COLOR_WHITE, 0, LED_BRIGHTNESS_MAX, Easing::STEP},
+  {COLOR_WHITE, COMPLETION_GLOW_MS - 5000, LED_BRIGHTNESS_MAX, Easing::LINEAR},
+  {COLOR_WHITE, 5000, 0, Easing::LINEAR},                               // Fade
+};
+
+// Breathing patterns a plan can choose, the first is the default
+constexpr Pattern PATTERNS[] = {
+  PATTERN("breath", BREATH_KEYS, 0),
+  PATTERN("box", BOX_KEYS, 0),
+  PATTERN("478", RELAX_478_KEYS, 0),
+  PATTERN("coherent", COHERENT_KEYS, 0),
+};
+constexpr int PATTERN_COUNT = sizeof(PATTERNS) / sizeof(Pattern);
+constexpr int PATTERN_CUSTOM = PATTERN_COUNT;  // sessionPattern for customPattern
+
+// Haptic library, in HapticEvent order. The motor stops after the last step.
+#define HAPTIC(steps, kickMs) {steps, sizeof(steps) / sizeof(HapticStep), kickMs}
+
+constexpr HapticStep START_STEPS[] = {
+  {HapticOp::SET, MOTOR_DUTY_FULL, MOTOR_PULSE_MS},
+};
+
+constexpr HapticStep GOAL_STEPS[] = {                                     // Three pulses
+  {HapticOp::SET, MOTOR_DUTY_FULL, MOTOR_PULSE_MS},
+  {HapticOp::SET, 0, MOTOR_PAUSE_MS},
+  {HapticOp::LOOP, 0, 1},
+  {HapticOp::SET, MOTOR_DUTY_FULL, MOTOR_PULSE_MS},
+};
+
+constexpr HapticStep END_STEPS[] = {                                      // Three, the last fading
+  {HapticOp::SET, MOTOR_DUTY_FULL, MOTOR_PULSE_MS},
+  {HapticOp::SET, 0, MOTOR_PAUSE_MS},
+  {HapticOp::LOOP, 0, 1},
+  {HapticOp::SET, MOTOR_DUTY_FULL, MOTOR_PULSE_MS},
+  {HapticOp::RAMP, 0, 600},
+};
+
+constexpr HapticStep REMINDER_STEPS[] = {                                 // Two slow swells
+  {HapticOp::RAMP, 220, 300},
+  {HapticOp::RAMP, 0, 300},
+  {HapticOp::SET, 0, 400},
+  {HapticOp::LOOP, 0, 1},
+};
+
+constexpr HapticStep LOW_BATTERY_STEPS[] = {                              // Double quick pulse
+  {HapticOp::SET, MOTOR_DUTY_FULL, 80},
+  {HapticOp::SET, 0, 120},
+  {HapticOp::LOOP, 0, 1},
+};
+
+constexpr HapticStep BELL_STEPS[] = {                                     // Strike and decay
+  {HapticOp::SET, MOTOR_DUTY_FULL, 60},
+  {HapticOp::RAMP, 0, 900},
+};
+
+constexpr HapticStep TICK_STEPS[] = {
+  {HapticOp::SET, HAPTIC_TICK_DUTY, HAPTIC_TICK_MS},
+};
+
+constexpr HapticPattern HAPTICS[] = {
+  HAPTIC(START_STEPS, 0),
+  HAPTIC(GOAL_STEPS, 0),
+  HAPTIC(END_STEPS, 0),
+  HAPTIC(REMINDER_STEPS, 0),
+  HAPTIC(LOW_BATTERY_STEPS, 0),
+  HAPTIC(BELL_STEPS, 0),
+  HAPTIC(TICK_STEPS, 0),
+};
+
+static_assert(sizeof(HAPTICS) / sizeof(HapticPattern) == HAPTIC_EVENT_COUNT,
+              "Every haptic event needs a built-in pattern");
+
+constexpr Pattern START_FLASH = PATTERN("start", START_KEYS, PATTERN_NO_LOOP);
+constexpr Pattern COMPLETION_GLOW = PATTERN("glow", GLOW_KEYS, PATTERN_NO_LOOP);
+
+// Session journal (see SESSION JOURNAL)
+// Types 1, 2 and 5 carried sessions and acks before the session ring.
+// PLAN, TOTAL and DROPPED are still replayed but now written as STATE.
+enum class RecordType : uint8_t {
+  PLAN = 3,      // Plan
+  TOTAL = 4,     // uint32_t total seconds
+  DROPPED = 6,   // uint32_t sessions lost to ring overflow
+  REBASE = 7,    // ClockRebase
+  STATE = 8,     // JournalState, all cached fields in one commit
+  CHECKPOINT = 9 // CheckpointRecord, the active session between commits
+};
+
+// Flash checkpoint on its own, a fraction of a STATE commit. The goal is
+// always whole minutes from the plan.
+struct __attribute__((packed)) CheckpointRecord {
+  uint32_t startEpoch;
+  uint32_t elapsedMs;
+  uint16_t goalMinutes;
+  uint16_t flags;            // CHECKPOINT_*
+};
+
+static_assert(sizeof(CheckpointRecord) == 12, "Checkpoint records must stay compact");
+
+// Lifetime flash wear, carried in every state commit
+struct FlashWear {
+  uint32_t logicalBytes;     // Session records, journal and log payloads, acks
+  uint32_t ringBytes;        // Bytes programmed, headers included
+  uint32_t journalBytes;
+  uint32_t ringErases;       // Sector erases
+  uint32_t journalErases;
+  uint32_t commits;          // Journal records
+};
+
+// The record logs, kept apart from FlashWear so older STATE records still
+// line up
+struct LogWear {
+  uint32_t traceBytes;       // Bytes programmed
+  uint32_t statsBytes;
+  uint32_t traceErases;      // Sector erases
+  uint32_t statsErases;
+};
+
+struct JournalState {        // Fields are only ever appended
+  uint32_t totalSeconds;
+  uint32_t sessionsDropped;
+  Plan plan;
+  SessionCheckpoint checkpoint;
+  uint32_t ackedUpTo;
+  FlashWear wear;
+  uint8_t sessionPattern;
+  uint8_t reserved[3];       // Was padding, unset in older records
+  uint8_t sessionGuidance;
+  BellSchedule bells;
+  LogWear logWear;
+};
+
+static_assert(sizeof(JournalState) <= JOURNAL_MAX_PAYLOAD, "State must fit one journal record");
+
+const esp_partition_t* journalPartition = nullptr;
+SemaphoreHandle_t journalMutex = nullptr;
+
+// Live items found in the sector being reclaimed
+bool reclaimState = false;
+bool reclaimRebases = false;
+
+// Write-back cache: plan, total and drop counter change in RAM and are
+// committed together once writes go quiet (see STORAGE CACHE)
+volatile uint8_t dirtyState = 0;
+volatile uint32_t lastStateChange = 0;
+uint32_t flashWriteCount = 0;      // Programs to any storage partition since boot
+FlashWear flashWear = {0, 0, 0, 0, 0, 0};
+LogWear logWear = {0, 0, 0, 0};
+uint32_t stateCommitCount = 0;     // Journal records appended since boot
+
+// =============================================================================
+// JSON ARENA
+// =============================================================================
+
+// ArduinoJson allocator over a fixed static buffer. All JSON work happens in
+// BLE callbacks (one task), so a single arena is reset at the start of each
+// parse/serialize and JSON work never touches the heap. Each block is
+// preceded by an 8-byte header holding its size, so a block that has to move
+// copies exactly what it held.
+class ArenaAllocator : public ArduinoJson::Allocator {
+ public:
+  ArenaAllocator(uint8_t* buffer, size_t size)
+    : buffer_(buffer), size_(size), used_(0), last_(nullptr) {}
+
+  void reset() {
+    used_ = 0;
+    last_ = nullptr;
+  }
+
+  void* allocate(size_t size) override {
+    size_t start = (used_ + 7) & ~(size_t)7;
+    if (start + HEADER + size > size_) {
+      return nullptr;
+    }
+    *(size_t*)(buffer_ + start) = size;
+    used_ = start + HEADER + size;
+    last_ = buffer_ + start + HEADER;
+    return last_;
+  }
+
+  void deallocate(void* ptr) override {
+    // Freed wholesale by reset()
+  }
+
+  void* reallocate(void* ptr, size_t newSize) override {
+    if (ptr == nullptr) {
+      return allocate(newSize);
+    }
+
+    // Most reallocations grow or shrink the newest block, do that in place
+    if (ptr == last_) {
+      size_t start = (uint8_t*)ptr - buffer_;
+      if (start + newSize > size_) {
+        return nullptr;
+      }
+      *(size_t*)((uint8_t*)ptr - HEADER) = newSize;
+      used_ = start + newSize;
+      return ptr;
+    }
+
+    size_t oldSize = *(size_t*)((uint8_t*)ptr - HEADER);
+    void* moved = allocate(newSize);
+    if (moved != nullptr) {
+      memmove(moved, ptr, newSize < oldSize ? newSize : oldSize);
+    }
+    return moved;
+  }
+
+ private:
+  static constexpr size_t HEADER = 8;  // Keeps blocks 8-byte aligned
+
+  uint8_t* buffer_;
+  size_t size_;
+  size_t used_;
+  uint8_t* last_;
+};
+
+alignas(8) uint8_t jsonArenaBuffer[JSON_ARENA_SIZE];
+ArenaAllocator jsonArena(jsonArenaBuffer, sizeof(jsonArenaBuffer));
+
+// Prebuilt read values, filled lazily in onRead
+char sessionsBuffer[SESSIONS_BUFFER_SIZE];
+char diagBuffer[DIAG_BUFFER_SIZE];
+char capsBuffer[CAPS_BUFFER_SIZE];
+
+// Diagnostics outgrew one read, so it is served a page at a time: the app
+// writes the page number, then reads it. Each page fits 512 bytes even with
+// every counter at its maximum.
+enum class DiagPage : uint8_t {
+  DEVICE,                    // Clock, storage and breath sync
+  TIMING,                    // LED and bell timing
+  HAPTICS,                   // Motor charge per event
+  ENERGY,                    // Output charge per guidance mode
+  LIFETIME,                  // Device counters and flash wear
+  COUNT
+};
+
+constexpr int DIAG_PAGE_COUNT = (int)DiagPage::COUNT;
+uint8_t diagPage = 0;              // Served by the next read, back to 0 on connect
 
 // =============================================================================
 // FORWARD DECLARATIONS
@@ -133,25 +824,86 @@ Plan todaysPlan = {0, 0, false, false};
 
 void setupBLE();
 void setupLED();
+void setupHaptics();
 void setupPins();
 void loadFromFlash();
-void saveToFlash();
+void saveSettings();
+void migrateFromPreferences();
 void handleTouch();
 void updateLED();
-void updateBLE();
+void playPattern(const Pattern* pattern);
+bool patternDone(uint32_t now);
+uint16_t renderPattern(uint32_t now, uint32_t* color);
+uint32_t easeSegment(Easing easing, uint32_t t, uint32_t duration);
+void showLED(uint32_t color, uint16_t level);
+int findPattern(const char* name);
+const Pattern* selectedPattern();
+uint32_t patternTime(uint32_t now, uint32_t introMs, uint32_t loopMs);
+bool syncBreath(uint64_t refEpochMs, uint32_t cycleMs);
+void advanceBreathClock(uint32_t now);
 void startSession();
 void endSession();
 void completeWithGoal();
-void pulseMotor(int count);
-void breatheLED();
-void glowLED();
+void checkpointSession();
+void saveCheckpoint(SessionCheckpoint* checkpoint);
+void clearCheckpoint();
+void recoverSession();
+void playHaptic(HapticEvent event);
+void hapticRun();
+void hapticWait(uint32_t ms);
+void hapticAdvance(void* arg);
+void hapticDone();
+void setMotor(uint32_t duty);
+void tickBreathPhase();
+void startBells(int64_t elapsedUs);
+void scheduleBell();
+void ringBell(void* arg);
+void traceBell();
+void meterSet(ChargeMeter* meter, uint32_t ua);
+uint64_t meterRead(const ChargeMeter* meter);
+void readOutputCharge(uint64_t* ledUaMs, uint64_t* motorUaMs);
 void offLED();
-String generateUUID();
-void addPendingSession(uint32_t start, uint32_t end, uint32_t duration);
-String getPendingSessionsJSON();
-void markSessionsSynced(const char* json);
-void storePlans(const char* json);
+bool sendLED(uint32_t color);
+void ledSent(rmt_channel_t channel, void* arg);
+void generateUUID(char* out);
+void addPendingSession(uint32_t start, uint32_t duration, uint8_t flags);
+size_t writePendingSessionsJSON(char* out, size_t size);
+void markSessionsSynced(const char* json, size_t length);
+bool rebaseSession(Session* session);
+void addClockRebase(const ClockRebase& rebase);
+void storePlans(const char* json, size_t length);
 void storeTotalHours(uint32_t total);
+bool storePattern(const uint8_t* data, size_t length);
+bool parsePattern(const uint8_t* data, size_t length, Keyframe* keys, Pattern* pattern);
+void loadPattern();
+bool storeHaptic(const uint8_t* data, size_t length);
+bool parseHaptic(const uint8_t* data, size_t length, HapticStep* steps, uint8_t* count,
+                 uint8_t* kickMs);
+void loadHaptics();
+void markDirty(uint8_t fields);
+void flushStorage(bool immediate);
+esp_err_t flashWrite(const esp_partition_t* partition, size_t offset, const void* data, size_t length);
+esp_err_t flashErase(const esp_partition_t* partition, size_t offset, size_t length);
+uint64_t monotonicMs();
+uint64_t wallClockMs();
+uint64_t monoToEpochMs(uint64_t monoMs);
+uint32_t sessionTimestamp(uint64_t monoMs);
+void setWallClock(uint64_t epochMs);
+void estimateDrift();
+size_t writeDiagnosticsJSON(char* out, size_t size, uint8_t page);
+size_t writeCapabilitiesJSON(char* out, size_t size);
+bool mountJournal();
+bool journalCommit(RecordType type, const void* payload, uint16_t length);
+void mountSessions();
+bool logMount(LogRegion* log);
+bool logSectorFirst(LogRegion* log, uint32_t sector, LogRecordHeader* header);
+bool logAppend(LogRegion* log, uint8_t type, const void* payload, size_t length);
+bool logRead(LogRegion* log, uint32_t index, LogRecordHeader* header, void* payload, size_t length);
+bool logRecordErased(LogRegion* log, uint32_t index);
+void trace(TraceEvent event, uint32_t arg);
+void traceDump();
+void statsRecordBoot();
+void statsSave();
 
 // =============================================================================
 // BLE CALLBACKS
@@ -160,7 +912,9 @@ void storeTotalHours(uint32_t total);
 class ServerCallbacks : public BLEServerCallbacks {
   void onConnect(BLEServer* pServer) {
     deviceConnected = true;
-    Serial.println("BLE client connected");
+    diagPage = 0;
+    syncResume();
+    Serial.printf("BLE client connected, resuming sync at seq %u\n", syncCursor);
   }
 
   void onDisconnect(BLEServer* pServer) {
@@ -171,35 +925,108 @@ class ServerCallbacks : public BLEServerCallbacks {
   }
 };
 
+// Writes are parsed in place from the BLE stack's value buffer and reads are
+// filled on demand from static buffers, so our own code allocates nothing.
+// The Arduino BLE library still does: it keeps each characteristic's value in
+// a std::string, which setValue() and every incoming write copy into. That
+// only reallocates when a value outgrows the string's earlier capacity.
+
+class HoursCallback : public BLECharacteristicCallbacks {
+  void onRead(BLECharacteristic* pChar) {
+    pChar->setValue((uint8_t*)&totalSeconds, 4);
+  }
+};
+
+class SessionsCallback : public BLECharacteristicCallbacks {
+  void onRead(BLECharacteristic* pChar) {
+    size_t length = writePendingSessionsJSON(sessionsBuffer, sizeof(sessionsBuffer));
+    pChar->setValue((uint8_t*)sessionsBuffer, length);
+  }
+};
+
 class PlansCallback : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic* pChar) {
-    std::string value = pChar->getValue();
-    if (value.length() > 0) {
-      storePlans(value.c_str());
+    if (pChar->getLength() > 0) {
+      storePlans((const char*)pChar->getData(), pChar->getLength());
     }
   }
 };
 
 class AckCallback : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic* pChar) {
-    std::string value = pChar->getValue();
-    if (value.length() > 0) {
-      markSessionsSynced(value.c_str());
+    if (pChar->getLength() > 0) {
+      markSessionsSynced((const char*)pChar->getData(), pChar->getLength());
     }
   }
 };
 
 class TotalCallback : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic* pChar) {
-    std::string value = pChar->getValue();
-    if (value.length() >= 4) {
+    if (pChar->getLength() >= 4) {
       uint32_t total;
-      memcpy(&total, value.data(), 4);
+      memcpy(&total, pChar->getData(), 4);
       storeTotalHours(total);
     }
   }
 };
 
+class TimeCallback : public BLECharacteristicCallbacks {
+  void onRead(BLECharacteristic* pChar) {
+    // 0 until the app sets it
+    uint64_t epochMs = wallClockMs();
+    pChar->setValue((uint8_t*)&epochMs, 8);
+  }
+
+  void onWrite(BLECharacteristic* pChar) {
+    if (pChar->getLength() >= 8) {
+      uint64_t epochMs;
+      memcpy(&epochMs, pChar->getData(), 8);
+      setWallClock(epochMs);
+    }
+  }
+};
+
+class PatternCallback : public BLECharacteristicCallbacks {
+  void onRead(BLECharacteristic* pChar) {
+    pChar->setValue(customPatternBytes, customPatternLength);
+  }
+
+  void onWrite(BLECharacteristic* pChar) {
+    storePattern(pChar->getData(), pChar->getLength());
+  }
+};
+
+class BreathSyncCallback : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic* pChar) {
+    if (pChar->getLength() >= 12) {
+      uint64_t refEpochMs;
+      uint32_t cycleMs;
+      memcpy(&refEpochMs, pChar->getData(), 8);
+      memcpy(&cycleMs, pChar->getData() + 8, 4);
+      syncBreath(refEpochMs, cycleMs);
+    }
+  }
+};
+
+class HapticCallback : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic* pChar) {
+    storeHaptic(pChar->getData(), pChar->getLength());
+  }
+};
+
+class DiagCallback : public BLECharacteristicCallbacks {
+  void onRead(BLECharacteristic* pChar) {
+    size_t length = writeDiagnosticsJSON(diagBuffer, sizeof(diagBuffer), diagPage);
+    pChar->setValue((uint8_t*)diagBuffer, length);
+  }
+
+  void onWrite(BLECharacteristic* pChar) {
+    if (pChar->getLength() >= 1) {
+      diagPage = pChar->getData()[0];
+    }
+  }
+};
+
 // =============================================================================
 // SETUP
 // =============================================================================
@@ -210,9 +1037,11 @@ void setup() {
   Serial.println("Meditation Band starting...");
 
   setupPins();
+  setupHaptics();
   setupLED();
   loadFromFlash();
   setupBLE();
+  recoverSession();
 
   Serial.println("Ready. Squeeze to start meditation.");
 }
@@ -220,19 +1049,46 @@ void setup() {
 void setupPins() {
   pinMode(PIN_TOUCH_LEFT, INPUT);
   pinMode(PIN_TOUCH_RIGHT, INPUT);
-  pinMode(PIN_MOTOR, OUTPUT);
-  digitalWrite(PIN_MOTOR, LOW);
 }
 
 void setupLED() {
-  FastLED.addLeds<WS2812B, PIN_LED_DATA, GRB>(leds, NUM_LEDS);
-  FastLED.setBrightness(LED_BRIGHTNESS_MAX);
-  leds[0] = CRGB::Black;
-  FastLED.show();
+  ledMutex = xSemaphoreCreateRecursiveMutex();
+
+  // The RMT clocks frames out on its own, see LED DRIVER
+  rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)PIN_LED_DATA, LED_RMT_CHANNEL);
+  config.clk_div = LED_RMT_CLK_DIV;
+  rmt_config(&config);
+  rmt_driver_install(LED_RMT_CHANNEL, 0, 0);
+  rmt_register_tx_end_callback(ledSent, nullptr);
+  sendLED(0);
+}
+
+void setupHaptics() {
+  hapticMutex = xSemaphoreCreateRecursiveMutex();
+
+  // PWM so the motor can run below full strength
+  ledcSetup(MOTOR_LEDC_CHANNEL, MOTOR_PWM_HZ, MOTOR_PWM_BITS);
+  ledcAttachPin(PIN_MOTOR, MOTOR_LEDC_CHANNEL);
+  ledcWrite(MOTOR_LEDC_CHANNEL, 0);
+
+  for (int event = 0; event < HAPTIC_EVENT_COUNT; event++) {
+    customHaptics[event] = {customHapticSteps[event], 0, 0};
+  }
+
+  // Plays patterns without the loop waiting on them
+  esp_timer_create_args_t args = {};
+  args.callback = hapticAdvance;
+  args.name = "haptic";
+  esp_timer_create(&args, &hapticTimer);
+
+  args.callback = ringBell;
+  args.name = "bell";
+  esp_timer_create(&args, &bellTimer);
 }
 
 void setupBLE() {
   BLEDevice::init("Meditation Band");
+  BLEDevice::setMTU(BLE_MAX_MTU);
   pServer = BLEDevice::createServer();
   pServer->setCallbacks(new ServerCallbacks());
 
@@ -243,6 +1099,7 @@ void setupBLE() {
     CHAR_HOURS_UUID,
     BLECharacteristic::PROPERTY_READ
   );
+  pHoursChar->setCallbacks(new HoursCallback());
 
   // Device status (read + notify)
   pStatusChar = pService->createCharacteristic(
@@ -256,6 +1113,7 @@ void setupBLE() {
     CHAR_SESSIONS_UUID,
     BLECharacteristic::PROPERTY_READ
   );
+  pSessionsChar->setCallbacks(new SessionsCallback());
 
   // Planned sessions (write)
   pPlansChar = pService->createCharacteristic(
@@ -278,6 +1136,50 @@ void setupBLE() {
   );
   pTotalChar->setCallbacks(new TotalCallback());
 
+  // Wall clock (read + write, epoch ms as uint64)
+  pTimeChar = pService->createCharacteristic(
+    CHAR_TIME_UUID,
+    BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE
+  );
+  pTimeChar->setCallbacks(new TimeCallback());
+
+  // Diagnostics (read JSON, write the page to read as uint8)
+  pDiagChar = pService->createCharacteristic(
+    CHAR_DIAG_UUID,
+    BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE
+  );
+  pDiagChar->setCallbacks(new DiagCallback());
+
+  // Capabilities (read, JSON). Fixed for the life of the firmware, so it is
+  // built once here rather than on every read.
+  pCapsChar = pService->createCharacteristic(
+    CHAR_CAPS_UUID,
+    BLECharacteristic::PROPERTY_READ
+  );
+  size_t capsLength = writeCapabilitiesJSON(capsBuffer, sizeof(capsBuffer));
+  pCapsChar->setValue((uint8_t*)capsBuffer, capsLength);
+
+  // Custom breath pattern (read + write, binary, see storePattern)
+  pPatternChar = pService->createCharacteristic(
+    CHAR_PATTERN_UUID,
+    BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE
+  );
+  pPatternChar->setCallbacks(new PatternCallback());
+
+  // Breath phase sync (write, epoch ms as uint64 + cycle ms as uint32)
+  pBreathSyncChar = pService->createCharacteristic(
+    CHAR_BREATH_SYNC_UUID,
+    BLECharacteristic::PROPERTY_WRITE
+  );
+  pBreathSyncChar->setCallbacks(new BreathSyncCallback());
+
+  // Haptic patterns (write, binary, see storeHaptic)
+  pHapticChar = pService->createCharacteristic(
+    CHAR_HAPTIC_UUID,
+    BLECharacteristic::PROPERTY_WRITE
+  );
+  pHapticChar->setCallbacks(new HapticCallback());
+
   pService->start();
 
   // Start advertising
@@ -298,7 +1200,16 @@ void setupBLE() {
 void loop() {
   handleTouch();
   updateLED();
-  updateBLE();
+  checkpointSession();
+  traceBell();
+  flushStorage(false);
+
+  // Erase the sector the ring writes next while nothing is running
+  if (currentState == State::IDLE && ringPartition != nullptr) {
+    xSemaphoreTakeRecursive(ringMutex, portMAX_DELAY);
+    ringPrepareSector();
+    xSemaphoreGiveRecursive(ringMutex);
+  }
 
   // Small delay to prevent tight loop
   delay(10);
@@ -362,6 +1273,7 @@ void startSession() {
   sessionStartTime = millis();
   sessionDuration = 0;
   goalReached = false;
+  sessionStartEpoch = clockSynced ? wallClockMs() / 1000 : 0;
 
   // Check if there's a goal from today's plan
   if (todaysPlan.active && todaysPlan.durationMinutes > 0) {
@@ -370,13 +1282,22 @@ void startSession() {
     goalDuration = 0;
   }
 
+  // Checkpoint straight away so even a short sit can be recovered
+  lastRtcCheckpoint = lastFlashCheckpoint = sessionStartTime - CHECKPOINT_FLASH_MS;
+  checkpointSession();
+
   // Single haptic pulse to confirm start
-  pulseMotor(1);
+  playHaptic(HapticEvent::START);
 
-  // Brief LED flash
-  leds[0] = CRGB::White;
-  FastLED.show();
-  delay(100);
+  // The guidance this session costs is metered from here to the end pulses
+  sessionMeterStart = millis();
+  readOutputCharge(&sessionLedUaMs, &sessionMotorUaMs);
+  breathSegment = PATTERN_NO_LOOP;
+
+  startBells(0);
+
+  // Brief LED flash, the breath pattern follows once it ends
+  playPattern(&START_FLASH);
 
   // Update BLE status
   uint8_t status = (uint8_t)State::ACTIVE;
@@ -389,27 +1310,55 @@ void startSession() {
 void endSession() {
   Serial.println("Ending session");
 
-  uint32_t endTime = millis();
-  sessionDuration = endTime - sessionStartTime;
+  sessionDuration = millis() - sessionStartTime;
+
+  // A bell already in the timer task sees the cleared deadline and neither
+  // plays nor schedules another
+  xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+  esp_timer_stop(bellTimer);
+  bellDeadlineUs = INT64_MAX;
+  xSemaphoreGiveRecursive(hapticMutex);
 
   // Only save if session was at least 10 seconds
   if (sessionDuration >= 10000) {
     uint32_t durationSeconds = sessionDuration / 1000;
 
-    // Add to pending sessions
-    addPendingSession(
-      sessionStartTime / 1000,  // Unix timestamp approximation
-      endTime / 1000,
-      durationSeconds
-    );
+    // Unix seconds once the clock has been set. A session resumed after a
+    // reset began before this boot, so its known start is used as is.
+    uint32_t startTime = sessionStartEpoch;
+    if (startTime == 0) {
+      uint32_t endTime = sessionTimestamp(monotonicMs());
+      startTime = endTime > durationSeconds ? endTime - durationSeconds : 0;
+    }
+
+    addPendingSession(startTime, durationSeconds, 0);
 
     // Update local total
     totalSeconds += durationSeconds;
-    saveToFlash();
+    markDirty(DIRTY_TOTAL);
+
+    deviceStats.sessionsRecorded++;
+    if (durationSeconds > deviceStats.longestSessionSeconds) {
+      deviceStats.longestSessionSeconds = durationSeconds;
+    }
+    statsSave();
   }
 
+  // Session and total are committed now rather than after the quiet period
+  clearCheckpoint();
+  flushStorage(true);
+
+  uint64_t ledUaMs;
+  uint64_t motorUaMs;
+  readOutputCharge(&ledUaMs, &motorUaMs);
+  GuidanceEnergy& energy = guidanceEnergy[(uint8_t)sessionGuidance];
+  energy.sessions++;
+  energy.sessionMs += millis() - sessionMeterStart;
+  energy.ledUaMs += ledUaMs - sessionLedUaMs;
+  energy.motorUaMs += motorUaMs - sessionMotorUaMs;
+
   // Three haptic pulses to signal completion
-  pulseMotor(3);
+  playHaptic(HapticEvent::END);
 
   // Enter settling state
   currentState = State::SETTLING;
@@ -422,103 +1371,457 @@ void endSession() {
   }
 
   // Start completion glow
-  leds[0] = CRGB::White;
-  FastLED.setBrightness(LED_BRIGHTNESS_MAX);
-  FastLED.show();
+  playPattern(&COMPLETION_GLOW);
 }
 
 void completeWithGoal() {
   Serial.println("Goal reached!");
   goalReached = true;
 
-  // Three haptic pulses
-  pulseMotor(3);
-
-  // If enforceGoal is true, auto-end the session
+  // If enforceGoal is true, auto-end the session, which has its own pulses
   if (todaysPlan.enforceGoal) {
     endSession();
+    return;
   }
+
   // Otherwise, just signal and keep running
+  playHaptic(HapticEvent::GOAL);
 }
 
-// =============================================================================
-// HAPTIC FEEDBACK
-// =============================================================================
+void checkpointSession() {
+  if (currentState != State::ACTIVE) {
+    return;
+  }
 
-void pulseMotor(int count) {
-  for (int i = 0; i < count; i++) {
-    digitalWrite(PIN_MOTOR, HIGH);
-    delay(MOTOR_PULSE_MS);
-    digitalWrite(PIN_MOTOR, LOW);
+  uint32_t now = millis();
+
+  if (now - lastRtcCheckpoint >= CHECKPOINT_RTC_MS) {
+    lastRtcCheckpoint = now;
+    saveCheckpoint(&rtcCheckpoint.checkpoint);
+    rtcCheckpoint.magic = RTC_CHECKPOINT_MAGIC;
+    rtcCheckpoint.crc = flashCRC(&rtcCheckpoint.checkpoint, sizeof(SessionCheckpoint));
+  }
+
+  // Appended as its own small record, the rest of the state is unchanged
+  if (now - lastFlashCheckpoint >= CHECKPOINT_FLASH_MS) {
+    lastFlashCheckpoint = now;
+    saveCheckpoint(&flashCheckpoint);
+    CheckpointRecord record = {flashCheckpoint.startEpoch, flashCheckpoint.elapsedMs,
+                               (uint16_t)(flashCheckpoint.goalMs / 60000),
+                               (uint16_t)flashCheckpoint.flags};
+    journalCommit(RecordType::CHECKPOINT, &record, sizeof(record));
+  }
+}
 
-    if (i < count - 1) {
-      delay(MOTOR_PAUSE_MS);
+void saveCheckpoint(SessionCheckpoint* checkpoint) {
+  checkpoint->startEpoch = sessionStartEpoch;
+  checkpoint->elapsedMs = millis() - sessionStartTime;
+  checkpoint->goalMs = goalDuration;
+  checkpoint->flags = CHECKPOINT_ACTIVE | (goalReached ? CHECKPOINT_GOAL_REACHED : 0);
+}
+
+void clearCheckpoint() {
+  rtcCheckpoint.magic = 0;
+  if (flashCheckpoint.flags & CHECKPOINT_ACTIVE) {
+    flashCheckpoint.flags = 0;
+    markDirty(DIRTY_CHECKPOINT);
+  }
+}
+
+void recoverSession() {
+  // A reset with RAM-speed recovery (watchdog, brownout, crash) resumes the
+  // session where it was; the wearer is most likely still sitting.
+  if (rtcCheckpoint.magic == RTC_CHECKPOINT_MAGIC &&
+      rtcCheckpoint.crc == flashCRC(&rtcCheckpoint.checkpoint, sizeof(SessionCheckpoint)) &&
+      (rtcCheckpoint.checkpoint.flags & CHECKPOINT_ACTIVE)) {
+    const SessionCheckpoint& checkpoint = rtcCheckpoint.checkpoint;
+
+    currentState = State::ACTIVE;
+    sessionStartTime = millis() - checkpoint.elapsedMs;
+    sessionStartEpoch = checkpoint.startEpoch;
+    goalDuration = checkpoint.goalMs;
+    goalReached = (checkpoint.flags & CHECKPOINT_GOAL_REACHED) != 0;
+    lastRtcCheckpoint = lastFlashCheckpoint = millis();
+    startBells((int64_t)checkpoint.elapsedMs * 1000);
+
+    uint8_t status = (uint8_t)State::ACTIVE;
+    pStatusChar->setValue(&status, 1);
+
+    Serial.printf("Resumed session after reset at %u s\n", checkpoint.elapsedMs / 1000);
+    trace(TraceEvent::SESSION_RESUMED, checkpoint.elapsedMs / 1000);
+    deviceStats.sessionsResumed++;
+    statsSave();
+    return;
+  }
+
+  // Otherwise power was lost for an unknown time. Close the session at its
+  // last flash checkpoint, which bounds the error to CHECKPOINT_FLASH_MS.
+  if (flashCheckpoint.flags & CHECKPOINT_ACTIVE) {
+    uint32_t durationSeconds = flashCheckpoint.elapsedMs / 1000;
+
+    if (durationSeconds >= 10) {
+      addPendingSession(flashCheckpoint.startEpoch, durationSeconds, SESSION_FLAG_RECOVERED);
+      totalSeconds += durationSeconds;
+      markDirty(DIRTY_TOTAL);
     }
+
+    Serial.printf("Recovered session of %u s after power loss\n", durationSeconds);
+    trace(TraceEvent::SESSION_RECOVERED, durationSeconds);
+    deviceStats.sessionsRecovered++;
+    statsSave();
   }
+
+  clearCheckpoint();
+  flushStorage(true);
 }
 
 // =============================================================================
-// LED CONTROL
+// HAPTIC FEEDBACK
 // =============================================================================
 
-void updateLED() {
-  uint32_t now = millis();
-
-  switch (currentState) {
-    case State::IDLE:
-      // LED off when idle (worn as bracelet)
-      if (leds[0] != CRGB::Black) {
-        leds[0] = CRGB::Black;
-        FastLED.show();
-      }
-      break;
+// Every buzz is a HapticPattern: steps that hold or ramp the motor's PWM
+// duty for a time, and loops back over earlier steps. The player runs off
+// an esp_timer, so a pattern never holds up the loop; each callback does
+// the steps that take no time and arms the timer for the next one that
+// does. A new pattern replaces whatever is playing.
+//
+// A coin motor takes tens of ms to spin up and below HAPTIC_STALL_DUTY does
+// not start from rest at all, so any step that starts it from rest below
+// that is kicked: full duty for the pattern's kick, or HAPTIC_KICK_MS, then
+// its own amplitude, within the step's own time. A ramp from rest carries
+// on from the stall duty after its kick. A pattern that sets a kick also
+// has it on any part-duty set from rest. A short kick and a low hold give
+// a crisp pulse on less charge than a long soft one. The motor is switched
+// low-side with a flyback diode, so it cannot be braked, only left to
+// coast.
+
+void playHaptic(HapticEvent event) {
+  const HapticPattern* custom = &customHaptics[(uint8_t)event];
+  const HapticPattern* pattern = custom->count > 0 ? custom : &HAPTICS[(uint8_t)event];
+
+  // Called from the loop and the BLE task
+  xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+  esp_timer_stop(hapticTimer);
+  hapticDone();
+  hapticPattern = pattern;
+  hapticEvent = event;
+  hapticStartUaMs = meterRead(&motorMeter);
+  hapticIndex = 0;
+  hapticStepMs = 0;
+  memset(hapticLoops, 0, sizeof(hapticLoops));
+  hapticRun();
+  xSemaphoreGiveRecursive(hapticMutex);
+}
 
-    case State::ACTIVE:
-      breatheLED();
+void hapticRun() {
+  while (hapticPattern != nullptr) {
+    if (hapticIndex >= hapticPattern->count) {
+      setMotor(0);
+      hapticDone();
+      return;
+    }
 
-      // Check for goal approach / completion
-      if (goalDuration > 0 && !goalReached) {
-        uint32_t elapsed = now - sessionStartTime;
+    const HapticStep& step = hapticPattern->steps[hapticIndex];
+    if (step.op == HapticOp::LOOP) {
+      // Counts down to 0, which leaves it ready for an enclosing loop
+      uint32_t& left = hapticLoops[hapticIndex];
+      if (left == 0) {
+        left = step.durationMs + 1;
+      }
+      hapticIndex = --left > 0 ? step.amplitude : hapticIndex + 1;
+      continue;
+    }
 
-        if (elapsed >= goalDuration) {
-          completeWithGoal();
+    if (hapticStepMs == 0) {
+      hapticRampFrom = motorDuty;
+
+      uint32_t kickMs = hapticPattern->kickMs > 0 ? hapticPattern->kickMs : HAPTIC_KICK_MS;
+      uint32_t kick = min(kickMs, (uint32_t)step.durationMs);
+      uint8_t below = hapticPattern->kickMs > 0 ? MOTOR_DUTY_FULL : HAPTIC_STALL_DUTY;
+      bool fromRest = motorDuty == 0 && step.amplitude > 0 &&
+                      (step.op == HapticOp::RAMP || step.amplitude < below);
+      if (fromRest && kick > 0) {
+        if (step.op == HapticOp::RAMP) {
+          hapticRampFrom = min(step.amplitude, (uint8_t)HAPTIC_STALL_DUTY);
         }
+        setMotor(MOTOR_DUTY_FULL);
+        hapticStepMs = kick;
+        hapticWait(kick);
+        return;
       }
-      break;
+    }
+    int32_t from = step.op == HapticOp::RAMP ? hapticRampFrom : step.amplitude;
+    int32_t duty = step.durationMs > 0
+                     ? from + (((int32_t)step.amplitude - from) * (int32_t)hapticStepMs) / step.durationMs
+                     : step.amplitude;
+    setMotor(duty);
+
+    if (hapticStepMs >= step.durationMs) {
+      hapticIndex++;
+      hapticStepMs = 0;
+      continue;
+    }
 
-    case State::SETTLING:
-      // Glow for COMPLETION_GLOW_MS, then fade and return to idle
-      {
-        static uint32_t settlingStart = 0;
-        if (settlingStart == 0) {
-          settlingStart = now;
-        }
+    // A ramp moves in small steps, a hold waits out its whole duration
+    uint32_t slice = step.durationMs - hapticStepMs;
+    if (step.op == HapticOp::RAMP) {
+      slice = min(slice, (uint32_t)HAPTIC_RAMP_STEP_MS);
+    }
+    hapticStepMs += slice;
+    hapticWait(slice);
+    return;
+  }
+}
 
-        uint32_t elapsed = now - settlingStart;
-
-        if (elapsed < COMPLETION_GLOW_MS) {
-          // Steady glow, maybe slight fade toward end
-          uint8_t brightness = LED_BRIGHTNESS_MAX;
-          if (elapsed > COMPLETION_GLOW_MS - 5000) {
-            // Fade in last 5 seconds
-            brightness = map(elapsed, COMPLETION_GLOW_MS - 5000, COMPLETION_GLOW_MS,
-                           LED_BRIGHTNESS_MAX, 0);
-          }
-          leds[0] = CRGB::White;
-          FastLED.setBrightness(brightness);
-          FastLED.show();
-        } else {
-          // Return to idle
-          currentState = State::IDLE;
-          settlingStart = 0;
-          offLED();
+void hapticWait(uint32_t ms) {
+  hapticDueUs = esp_timer_get_time() + ms * 1000;
+  esp_timer_start_once(hapticTimer, ms * 1000);
+}
+
+void hapticAdvance(void* arg) {
+  xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+  // A callback that was already waiting when a new pattern started is
+  // early for the new one's timer, and is dropped
+  if (esp_timer_get_time() >= hapticDueUs) {
+    hapticRun();
+  }
+  xSemaphoreGiveRecursive(hapticMutex);
+}
+
+void hapticDone() {
+  // Charge up to the end, or up to being cut off by the next pattern
+  if (hapticPattern == nullptr) {
+    return;
+  }
+  uint32_t charge = meterRead(&motorMeter) - hapticStartUaMs;
+  HapticStats& stats = hapticStats[(uint8_t)hapticEvent];
+  stats.plays++;
+  stats.uaMs += charge;
+  stats.lastUaMs = charge;
+  hapticPattern = nullptr;
+}
+
+void setMotor(uint32_t duty) {
+  xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+  if (duty != motorDuty) {
+    ledcWrite(MOTOR_LEDC_CHANNEL, duty);
+    meterSet(&motorMeter, MOTOR_CURRENT_UA * duty / MOTOR_DUTY_FULL);
+    motorDuty = duty;
+  }
+  xSemaphoreGiveRecursive(hapticMutex);
+}
+
+void tickBreathPhase() {
+  // Tick as the breath moves on to its next keyframe: in, hold, out. The
+  // start flash and the first frame of the breath only note where it is,
+  // and a jump to any other keyframe, as when the breath clock first
+  // locks, follows silently.
+  const Pattern* pattern = selectedPattern();
+  if (ledPattern != pattern || ledSegment >= pattern->count) {
+    breathSegment = PATTERN_NO_LOOP;
+    return;
+  }
+  if (ledSegment == breathSegment) {
+    return;
+  }
+
+  uint8_t next = breathSegment + 1 < pattern->count ? breathSegment + 1 : pattern->loopStart;
+  // A bell or other pattern still playing is not cut off for a tick
+  if (breathSegment != PATTERN_NO_LOOP && ledSegment == next && hapticPattern == nullptr) {
+    playHaptic(HapticEvent::TICK);
+  }
+  breathSegment = ledSegment;
+}
+
+// Output current is modelled from what is driven: LED duty per channel
+// and motor PWM duty, each against its full-duty draw. Integrating it
+// over time gives the charge each guidance mode costs.
+
+void meterSet(ChargeMeter* meter, uint32_t ua) {
+  uint32_t now = millis();
+  meter->uaMs += (uint64_t)meter->ua * (now - meter->since);
+  meter->ua = ua;
+  meter->since = now;
+}
+
+uint64_t meterRead(const ChargeMeter* meter) {
+  return meter->uaMs + (uint64_t)meter->ua * (millis() - meter->since);
+}
+
+void readOutputCharge(uint64_t* ledUaMs, uint64_t* motorUaMs) {
+  xSemaphoreTakeRecursive(ledMutex, portMAX_DELAY);
+  *ledUaMs = meterRead(&ledMeter);
+  xSemaphoreGiveRecursive(ledMutex);
+
+  xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+  *motorUaMs = meterRead(&motorMeter);
+  xSemaphoreGiveRecursive(hapticMutex);
+}
+
+// =============================================================================
+// INTERVAL BELLS
+// =============================================================================
+
+// Bells are deadlines on the esp_timer clock counted from the session
+// start, not from the previous bell, so callback latency never adds up
+// over a long sit. The esp_timer wakes the chip from light sleep for its
+// alarms, and the bell fires from the timer task without waiting on the
+// loop. Each bell's lateness, measured once the motor is driven, goes to
+// the trace log and to Diagnostics.
+
+void startBells(int64_t elapsedUs) {
+  xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+  bellBaseUs = esp_timer_get_time() - elapsedUs;
+  bellDeadlineUs = 0;
+  scheduleBell();
+  xSemaphoreGiveRecursive(hapticMutex);
+}
+
+void scheduleBell() {
+  // From the loop, the BLE task on a plan change, and the timer task
+  xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+  esp_timer_stop(bellTimer);
+  // Ended, as when a plan change raced the end of the session
+  if (bellDeadlineUs == INT64_MAX) {
+    xSemaphoreGiveRecursive(hapticMutex);
+    return;
+  }
+
+  // The earliest interval or one-off bell still ahead. Those landing while
+  // the goal's own pulses play are skipped, and with an enforced goal
+  // there are none past it.
+  int64_t now = esp_timer_get_time();
+  int64_t after = now - bellBaseUs;
+  int64_t goalUs = (int64_t)goalDuration * 1000;
+  int64_t next;
+  do {
+    next = INT64_MAX;
+    if (bellSchedule.everySeconds > 0) {
+      int64_t periodUs = (int64_t)bellSchedule.everySeconds * 1000000;
+      next = (after / periodUs + 1) * periodUs;
+    }
+    for (uint8_t i = 0; i < bellSchedule.count; i++) {
+      int64_t atUs = (int64_t)bellSchedule.atSeconds[i] * 1000000;
+      if (atUs > after && atUs < next) {
+        next = atUs;
+      }
+    }
+    after = next;
+  } while (next != INT64_MAX && goalUs > 0 && next >= goalUs &&
+           next < goalUs + GOAL_BELL_QUIET_MS * 1000);
+  if (goalUs > 0 && next >= goalUs && todaysPlan.enforceGoal) {
+    next = INT64_MAX;
+  }
+
+  if (next != INT64_MAX) {
+    bellDeadlineUs = bellBaseUs + next;
+    esp_timer_start_once(bellTimer, bellDeadlineUs - now);
+  }
+  xSemaphoreGiveRecursive(hapticMutex);
+}
+
+void ringBell(void* arg) {
+  xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+  // Already waiting when a plan change moved the bell or the session ended
+  if (currentState != State::ACTIVE || esp_timer_get_time() < bellDeadlineUs) {
+    xSemaphoreGiveRecursive(hapticMutex);
+    return;
+  }
+  playHaptic(HapticEvent::BELL);
+  int32_t errorUs = esp_timer_get_time() - bellDeadlineUs;
+
+  bellStats.fired++;
+  bellStats.lastErrorUs = errorUs;
+  bellStats.maxErrorUs = max(bellStats.maxErrorUs, errorUs);
+  bellStats.sumErrorUs += errorUs;
+
+  // Flash writes stay out of the timer task, the loop logs it
+  bellTraceErrorUs = errorUs;
+  bellTracePending = true;
+
+  scheduleBell();
+  xSemaphoreGiveRecursive(hapticMutex);
+}
+
+void traceBell() {
+  if (bellTracePending) {
+    bellTracePending = false;
+    trace(TraceEvent::BELL, bellTraceErrorUs);
+    Serial.printf("Bell %u, %d us late\n", bellStats.fired, bellTraceErrorUs);
+  }
+}
+
+// =============================================================================
+// LED CONTROL
+// =============================================================================
+
+// Everything the LED shows is a Pattern played by one renderer: keyframes
+// of colour and brightness, each reached over its duration along an easing
+// curve. Patterns are constexpr data in flash, so a new one needs no code
+// and no RAM beyond the pointer to what is playing.
+
+void updateLED() {
+  uint32_t now = millis();
+  uint32_t color;
+  uint16_t level;
+  bool goalDue = false;
+
+  // An uploaded pattern or the breath lock may change from the BLE task
+  xSemaphoreTakeRecursive(ledMutex, portMAX_DELAY);
+  int64_t start = esp_timer_get_time();
+  advanceBreathClock(now);
+
+  switch (currentState) {
+    case State::IDLE:
+      // LED off when idle (worn as bracelet)
+      showLED(0, 0);
+      break;
+
+    case State::ACTIVE:
+      // Breathe once the start flash is over, or straight away on recovery
+      if (patternDone(now)) {
+        playPattern(selectedPattern());
+      }
+      level = renderPattern(now, &color);
+
+      if (sessionGuidance == Guidance::HAPTIC) {
+        // Eyes closed: the LED stays dark and the motor marks each phase
+        tickBreathPhase();
+        color = 0;
+      }
+
+      // Check for goal approach / completion
+      if (goalDuration > 0 && !goalReached) {
+        uint32_t elapsed = now - sessionStartTime;
+
+        if (goalDuration > GOAL_APPROACH_MS && elapsed > goalDuration - GOAL_APPROACH_MS) {
+          // In the last 2 minutes, gradually raise brightness by up to half
+          // the remaining headroom. Progress is in Q10.
+          uint32_t approach = (elapsed - (goalDuration - GOAL_APPROACH_MS)) * 1024 / GOAL_APPROACH_MS;
+          level += (approach * (0xFF00 - level)) >> 11;
+        }
+        showLED(color, level);
+        goalDue = elapsed >= goalDuration;
+      } else {
+        showLED(color, level);
+      }
+      break;
 
-          // Update BLE status
-          uint8_t status = (uint8_t)State::IDLE;
-          pStatusChar->setValue(&status, 1);
-          if (deviceConnected) {
-            pStatusChar->notify();
-          }
+    case State::SETTLING:
+      // Glow for COMPLETION_GLOW_MS, fading out at the end, then go idle
+      if (!patternDone(now)) {
+        level = renderPattern(now, &color);
+        showLED(sessionGuidance == Guidance::HAPTIC ? 0 : color, level);
+      } else {
+        // Return to idle
+        currentState = State::IDLE;
+        offLED();
+
+        // Update BLE status
+        uint8_t status = (uint8_t)State::IDLE;
+        pStatusChar->setValue(&status, 1);
+        if (deviceConnected) {
+          pStatusChar->notify();
         }
       }
       break;
@@ -526,157 +1829,594 @@ void updateLED() {
     default:
       break;
   }
+
+  // The frame's cost, as measured for the send in sendLED. Ending the
+  // session writes flash, so it is left out.
+  uint32_t elapsed = esp_timer_get_time() - start;
+  ledStats.updates++;
+  ledStats.updateUs += elapsed;
+  if (elapsed > ledStats.maxUpdateUs) {
+    ledStats.maxUpdateUs = elapsed;
+  }
+
+  if (goalDue) {
+    completeWithGoal();
+  }
+
+  xSemaphoreGiveRecursive(ledMutex);
 }
 
-void breatheLED() {
-  // Sinusoidal breath pattern over BREATH_CYCLE_MS
-  uint32_t now = millis();
-  uint32_t elapsed = now - sessionStartTime;
-  float phase = (float)(elapsed % BREATH_CYCLE_MS) / BREATH_CYCLE_MS;
+void playPattern(const Pattern* pattern) {
+  ledPattern = pattern;
+  ledPatternStart = millis();
+}
+
+bool patternDone(uint32_t now) {
+  if (ledPattern == nullptr) {
+    return true;
+  }
+  if (ledPattern->loopStart != PATTERN_NO_LOOP) {
+    return false;
+  }
+
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < ledPattern->count; i++) {
+    total += ledPattern->keyframes[i].durationMs;
+  }
+  return now - ledPatternStart >= total;
+}
+
+uint16_t renderPattern(uint32_t now, uint32_t* color) {
+  // Brightness in Q8.8 and colour at this point of the current pattern
+  if (ledPattern == nullptr || ledPattern->count == 0) {
+    *color = 0;
+    return 0;
+  }
+
+  const Keyframe* keys = ledPattern->keyframes;
+  uint8_t count = ledPattern->count;
+  uint8_t loopStart = ledPattern->loopStart;
+
+  uint32_t introMs = 0;
+  uint32_t loopMs = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (i < loopStart) {
+      introMs += keys[i].durationMs;
+    } else {
+      loopMs += keys[i].durationMs;
+    }
+  }
+
+  // Find the segment, folding time past the intro into the loop
+  uint32_t t = patternTime(now, introMs, loopMs);
+  uint8_t i = 0;
+  bool looping = false;
+  if (loopStart < count && loopMs > 0 && t >= introMs) {
+    t = (t - introMs) % loopMs;
+    i = loopStart;
+    looping = true;
+  }
+  while (i < count && t >= keys[i].durationMs) {
+    t -= keys[i].durationMs;
+    i++;
+  }
+  ledSegment = i;
+
+  if (i == count) {
+    // Finished, hold the last keyframe
+    *color = keys[count - 1].color;
+    return keys[count - 1].level << 8;
+  }
+
+  const Keyframe& to = keys[i];
+  const Keyframe& from = keys[(looping && i == loopStart) ? count - 1 : (i > 0 ? i - 1 : 0)];
+  int32_t eased = easeSegment(to.easing, t, to.durationMs);
+
+  *color = 0;
+  for (int shift = 0; shift < 24; shift += 8) {
+    int32_t a = (from.color >> shift) & 0xFF;
+    int32_t b = (to.color >> shift) & 0xFF;
+    *color |= (uint32_t)(a + (((b - a) * eased) >> 16)) << shift;
+  }
+  return (from.level << 8) + ((((int32_t)to.level - from.level) * eased) >> 8);
+}
+
+uint32_t easeSegment(Easing easing, uint32_t t, uint32_t duration) {
+  // Progress through a segment in Q16, 65536 once the keyframe is reached
+  switch (easing) {
+    case Easing::STEP:
+      return 65536;
+
+    case Easing::LINEAR:
+      return t * 65536 / duration;
+
+    case Easing::SINE:
+      // The rising half of the breath curve
+      return breathCurve(t * 32768 / duration);
 
-  // Sine wave: 0 -> 1 -> 0 over one cycle
-  float breathValue = (sin(phase * 2 * PI - PI / 2) + 1) / 2;
+    default:
+      return 65536;
+  }
+}
+
+void showLED(uint32_t color, uint16_t level) {
+  // Lightness to duty in Q16 through the gamma table
+  uint32_t step = level >> 8;
+  uint32_t duty = GAMMA_TABLE[step] +
+                  (((GAMMA_TABLE[step + 1] - GAMMA_TABLE[step]) * (level & 0xFF)) >> 8);
+
+  // Each channel lands between two 8-bit values. Temporal dithering sends
+  // the lower or upper one frame by frame and carries the remainder, so
+  // the average over a few frames keeps the full fraction. The carry is
+  // kept only once the frame is on the LED.
+  uint32_t out = 0;
+  uint8_t carry[3] = {0, 0, 0};
+  for (int i = 0; i < 3; i++) {
+    int shift = 16 - 8 * i;
+    uint32_t value = (((color >> shift) & 0xFF) * duty >> 8) + ledDither[i];
+    out |= (value >> 8) << shift;
+    carry[i] = value & 0xFF;
+  }
+  if (level == 0) {
+    out = 0;
+    memset(carry, 0, sizeof(carry));
+  }
 
-  // Map to brightness range
-  uint8_t brightness = LED_BRIGHTNESS_MIN +
-                       (uint8_t)(breathValue * (LED_BRIGHTNESS_MAX - LED_BRIGHTNESS_MIN));
+  // Only send a frame that changed. One that finds the driver busy is
+  // dropped with its carry, and recomputed by the next call, 10 ms later.
+  if (out == ledShown) {
+    memcpy(ledDither, carry, sizeof(ledDither));
+  } else if (sendLED(out)) {
+    memcpy(ledDither, carry, sizeof(ledDither));
+    ledShown = out;
+    uint32_t channels = (out >> 16) + ((out >> 8) & 0xFF) + (out & 0xFF);
+    meterSet(&ledMeter, channels * LED_CHANNEL_UA / 255);
+  }
+}
 
-  // If approaching goal, increase base brightness
-  if (goalDuration > 0 && !goalReached) {
-    uint32_t elapsedMs = now - sessionStartTime;
-    if (goalDuration > GOAL_APPROACH_MS && elapsedMs > goalDuration - GOAL_APPROACH_MS) {
-      // In the last 2 minutes, gradually increase brightness
-      float approachProgress = (float)(elapsedMs - (goalDuration - GOAL_APPROACH_MS)) / GOAL_APPROACH_MS;
-      brightness = brightness + (uint8_t)(approachProgress * (255 - brightness) * 0.5);
+int findPattern(const char* name) {
+  for (int i = 0; i < PATTERN_COUNT; i++) {
+    if (strcmp(PATTERNS[i].name, name) == 0) {
+      return i;
     }
   }
+  if (strcmp(customPattern.name, name) == 0) {
+    return PATTERN_CUSTOM;
+  }
+  return -1;
+}
+
+uint32_t patternTime(uint32_t now, uint32_t introMs, uint32_t loopMs) {
+  // Time into the current pattern. A looping session pattern follows the
+  // app's breath clock once locked, stretched to its cycle.
+  if (!breathClock.locked || ledPattern != selectedPattern() ||
+      ledPattern->loopStart == PATTERN_NO_LOOP || loopMs == 0) {
+    return now - ledPatternStart;
+  }
 
-  // Soft white/warm color
-  leds[0] = CRGB(brightness, brightness, (uint8_t)(brightness * 0.9));
-  FastLED.setBrightness(255); // Use color values directly
-  FastLED.show();
+  int64_t cycleUs = (int64_t)breathClock.cycleMs * 1000;
+  int64_t phaseUs = breathClock.appTimeUs % cycleUs;
+  if (phaseUs < 0) {
+    phaseUs += cycleUs;
+  }
+  return introMs + (uint32_t)((uint64_t)phaseUs * loopMs / cycleUs);
 }
 
-void glowLED() {
-  leds[0] = CRGB::White;
-  FastLED.setBrightness(LED_BRIGHTNESS_MAX);
-  FastLED.show();
+const Pattern* selectedPattern() {
+  // The custom choice falls back to the default until one is uploaded
+  if (sessionPattern == PATTERN_CUSTOM) {
+    return customPattern.count > 0 ? &customPattern : &PATTERNS[0];
+  }
+  return &PATTERNS[sessionPattern];
 }
 
 void offLED() {
-  leds[0] = CRGB::Black;
-  FastLED.show();
+  xSemaphoreTakeRecursive(ledMutex, portMAX_DELAY);
+  ledPattern = nullptr;
+  showLED(0, 0);
+  xSemaphoreGiveRecursive(ledMutex);
 }
 
 // =============================================================================
-// BLE UPDATES
+// LED DRIVER
 // =============================================================================
 
-void updateBLE() {
-  // Update hours characteristic
-  pHoursChar->setValue((uint8_t*)&totalSeconds, 4);
+// The RMT peripheral clocks a frame out to the WS2812B by itself: sendLED
+// encodes one item per bit, hands them over and returns while they go out.
+// A blocking show() spins through the 30 us frame with interrupts off and
+// then waits out the latch, which touch sampling and the BLE stack would
+// feel 100 times a second. The latch rides along as a final low item, so
+// the end-of-transmission interrupt marks the strip ready for the next
+// frame.
+
+bool sendLED(uint32_t color) {
+  if (ledBusy) {
+    ledStats.busy++;
+    return false;
+  }
+
+  int64_t start = esp_timer_get_time();
+
+  // WS2812B takes green, red, blue, most significant bit first
+  const rmt_item32_t zero = {{{WS2812_T0H_TICKS, 1, WS2812_T0L_TICKS, 0}}};
+  const rmt_item32_t one = {{{WS2812_T1H_TICKS, 1, WS2812_T1L_TICKS, 0}}};
+  uint32_t grb = ((color & 0x00FF00) << 8) | ((color & 0xFF0000) >> 8) | (color & 0xFF);
+  rmt_item32_t* item = ledItems;
+  for (int led = 0; led < NUM_LEDS; led++) {
+    for (uint32_t bit = 1 << 23; bit != 0; bit >>= 1) {
+      *item++ = (grb & bit) ? one : zero;
+    }
+  }
+  // A zero second half ends the transmission
+  *item = {{{WS2812_LATCH_TICKS, 0, 0, 0}}};
+
+  ledBusy = true;
+  if (rmt_write_items(LED_RMT_CHANNEL, ledItems, LED_FRAME_ITEMS, false) != ESP_OK) {
+    ledBusy = false;
+    return false;
+  }
+
+  uint32_t elapsed = esp_timer_get_time() - start;
+  ledStats.frames++;
+  ledStats.sendUs += elapsed;
+  if (elapsed > ledStats.maxSendUs) {
+    ledStats.maxSendUs = elapsed;
+  }
+  return true;
+}
 
-  // Update sessions characteristic
-  String sessionsJson = getPendingSessionsJSON();
-  pSessionsChar->setValue(sessionsJson.c_str());
+void IRAM_ATTR ledSent(rmt_channel_t channel, void* arg) {
+  // End-of-transmission interrupt, after the latch
+  ledBusy = false;
 }
 
 // =============================================================================
-// SESSION STORAGE
+// BLE UPDATES
 // =============================================================================
 
-void addPendingSession(uint32_t start, uint32_t end, uint32_t duration) {
-  if (pendingSessionCount >= MAX_PENDING_SESSIONS) {
-    // Shift array, dropping oldest
-    for (int i = 0; i < MAX_PENDING_SESSIONS - 1; i++) {
-      pendingSessions[i] = pendingSessions[i + 1];
+size_t writeDiagnosticsJSON(char* out, size_t size, uint8_t page) {
+  jsonArena.reset();
+  JsonDocument doc(&jsonArena);
+
+  // An unknown page comes back with just these two
+  doc["page"] = page;
+  doc["pages"] = DIAG_PAGE_COUNT;
+
+  switch ((DiagPage)page) {
+    case DiagPage::DEVICE:
+      doc["uptimeMs"] = monotonicMs();
+      doc["clockSynced"] = clockSynced;
+      doc["timeSyncs"] = timeSyncCount;
+      doc["lastSyncErrorMs"] = lastSyncErrorMs;
+      doc["driftPpm"] = driftPpb / 1000.0f;
+      if (driftUncertaintyPpb >= 0) {
+        doc["driftUncertaintyPpm"] = driftUncertaintyPpb / 1000.0f;
+      }
+      doc["pendingSessions"] = pendingSessionCount;
+      doc["sessionsDropped"] = sessionsDropped;
+      doc["flashWrites"] = flashWriteCount;
+      doc["stateCommits"] = stateCommitCount;
+
+      if (breathClock.syncs > 0) {
+        JsonObject breath = doc["breathSync"].to<JsonObject>();
+        breath["locked"] = breathClock.locked;
+        breath["cycleMs"] = breathClock.cycleMs;
+        breath["syncs"] = breathClock.syncs;
+        breath["lastErrorMs"] = breathClock.lastErrorMs;
+        breath["maxErrorMs"] = breathClock.maxErrorMs;
+        breath["ratePpm"] = breathClock.ratePpm;
+      }
+      break;
+
+    case DiagPage::TIMING: {
+      xSemaphoreTakeRecursive(ledMutex, portMAX_DELAY);
+      LedStats ledCopy = ledStats;
+      xSemaphoreGiveRecursive(ledMutex);
+      JsonObject led = doc["led"].to<JsonObject>();
+      led["frames"] = ledCopy.frames;
+      led["busy"] = ledCopy.busy;
+      led["avgSendUs"] = ledCopy.frames > 0 ? (uint32_t)(ledCopy.sendUs / ledCopy.frames) : 0;
+      led["maxSendUs"] = ledCopy.maxSendUs;
+      led["updates"] = ledCopy.updates;
+      led["avgUpdateUs"] = ledCopy.updates > 0 ? (uint32_t)(ledCopy.updateUs / ledCopy.updates) : 0;
+      led["maxUpdateUs"] = ledCopy.maxUpdateUs;
+
+      if (bellStats.fired > 0) {
+        JsonObject bells = doc["bells"].to<JsonObject>();
+        bells["fired"] = bellStats.fired;
+        bells["lastErrorUs"] = bellStats.lastErrorUs;
+        bells["maxErrorUs"] = bellStats.maxErrorUs;
+        bells["meanErrorUs"] = (int32_t)(bellStats.sumErrorUs / bellStats.fired);
+      }
+      break;
+    }
+
+    case DiagPage::HAPTICS: {
+      // Modelled motor charge per play, for events played since boot
+      xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+      HapticStats hapticCopy[HAPTIC_EVENT_COUNT];
+      memcpy(hapticCopy, hapticStats, sizeof(hapticStats));
+      xSemaphoreGiveRecursive(hapticMutex);
+      JsonObject haptics = doc["haptics"].to<JsonObject>();
+      for (int i = 0; i < HAPTIC_EVENT_COUNT; i++) {
+        const HapticStats& h = hapticCopy[i];
+        if (h.plays == 0) {
+          continue;
+        }
+        JsonObject event = haptics[HAPTIC_EVENT_NAMES[i]].to<JsonObject>();
+        event["plays"] = h.plays;
+        // A play lasts at most HAPTIC_MAX_MS, so these stay within 6 digits
+        // and seven events fit one read
+        event["lastUcEst"] = h.lastUaMs / 1000;
+        event["avgUcEst"] = (uint32_t)(h.uaMs / h.plays / 1000);
+      }
+      break;
+    }
+
+    case DiagPage::ENERGY: {
+      // Modelled output charge per guidance mode, for modes used since boot
+      JsonObject energy = doc["energy"].to<JsonObject>();
+      for (int i = 0; i < GUIDANCE_COUNT; i++) {
+        const GuidanceEnergy& e = guidanceEnergy[i];
+        if (e.sessions == 0) {
+          continue;
+        }
+        JsonObject mode = energy[GUIDANCE_NAMES[i]].to<JsonObject>();
+        mode["sessions"] = e.sessions;
+        mode["minutes"] = (uint32_t)(e.sessionMs / 60000);
+        mode["ledUahEst"] = (uint32_t)(e.ledUaMs / 3600000);
+        mode["motorUahEst"] = (uint32_t)(e.motorUaMs / 3600000);
+        mode["avgUaEst"] = e.sessionMs > 0 ? (uint32_t)((e.ledUaMs + e.motorUaMs) / e.sessionMs) : 0;
+      }
+      break;
+    }
+
+    case DiagPage::LIFETIME: {
+      JsonObject stats = doc["stats"].to<JsonObject>();
+      stats["boots"] = deviceStats.boots;
+      stats["abnormalResets"] = deviceStats.abnormalResets;
+      stats["sessionsRecorded"] = deviceStats.sessionsRecorded;
+      stats["sessionsResumed"] = deviceStats.sessionsResumed;
+      stats["sessionsRecovered"] = deviceStats.sessionsRecovered;
+      stats["longestSessionSeconds"] = deviceStats.longestSessionSeconds;
+      stats["traceEvents"] = traceLog.nextSeq - 1;
+
+      JsonObject wear = doc["flash"].to<JsonObject>();
+      wear["logicalBytes"] = flashWear.logicalBytes;
+      wear["ringBytes"] = flashWear.ringBytes;
+      wear["ringErases"] = flashWear.ringErases;
+      wear["journalBytes"] = flashWear.journalBytes;
+      wear["journalErases"] = flashWear.journalErases;
+      wear["traceBytes"] = logWear.traceBytes;
+      wear["traceErases"] = logWear.traceErases;
+      wear["statsBytes"] = logWear.statsBytes;
+      wear["statsErases"] = logWear.statsErases;
+      wear["commits"] = flashWear.commits;
+      break;
     }
-    pendingSessionCount = MAX_PENDING_SESSIONS - 1;
+
+    default:
+      break;
+  }
+
+  return serializeJson(doc, out, size);
+}
+
+size_t writeCapabilitiesJSON(char* out, size_t size) {
+  jsonArena.reset();
+  JsonDocument doc(&jsonArena);
+
+  doc["firmware"] = FIRMWARE_VERSION;
+  doc["protocol"] = PROTOCOL_VERSION;
+
+  JsonArray encodings = doc["encodings"].to<JsonArray>();
+  encodings.add("json");
+
+  JsonArray features = doc["features"].to<JsonArray>();
+  features.add("wallClock");
+  features.add("diagnostics");
+  features.add("resumableSync");
+  features.add("ackUpTo");
+  features.add("patterns");
+  features.add("customPattern");
+  features.add("breathSync");
+  features.add("hapticGuidance");
+  features.add("hapticPatterns");
+  features.add("intervalBells");
+  features.add("hapticKick");
+  features.add("diagnosticsPages");
+
+  JsonArray patterns = doc["patterns"].to<JsonArray>();
+  for (int i = 0; i < PATTERN_COUNT; i++) {
+    patterns.add(PATTERNS[i].name);
+  }
+
+  JsonArray haptics = doc["haptics"].to<JsonArray>();
+  for (int i = 0; i < HAPTIC_EVENT_COUNT; i++) {
+    haptics.add(HAPTIC_EVENT_NAMES[i]);
   }
 
-  Session& session = pendingSessions[pendingSessionCount];
+  doc["maxPatternKeyframes"] = PATTERN_MAX_KEYFRAMES;
+  doc["maxHapticSteps"] = HAPTIC_MAX_STEPS;
+  doc["maxHapticKickMs"] = HAPTIC_MAX_KICK_MS;
+  doc["maxBellTimes"] = MAX_BELL_TIMES;
+  doc["maxMtu"] = BLE_MAX_MTU;
+  doc["maxReadBytes"] = SESSIONS_BUFFER_SIZE;
+  doc["diagnosticsPages"] = DIAG_PAGE_COUNT;
+  // Guaranteed capacity: the sector being reused is never counted
+  doc["maxPendingSessions"] = ringSlotCount > 0 ? ringSlotCount - RING_SLOTS_PER_SECTOR : 0;
+  doc["overflowPolicy"] =
+    RING_OVERFLOW_POLICY == OverflowPolicy::DROP_OLDEST ? "dropOldest" : "dropNewest";
+
+  return serializeJson(doc, out, size);
+}
+
+// =============================================================================
+// SESSION STORAGE
+// =============================================================================
+
+void addPendingSession(uint32_t start, uint32_t duration, uint8_t flags) {
+  Session session;
 
-  // Generate UUID
-  String uuid = generateUUID();
-  strncpy(session.uuid, uuid.c_str(), 36);
-  session.uuid[36] = '\0';
+  generateUUID(session.uuid);
+  session.flags = flags;
 
   session.startTime = start;
-  session.endTime = end;
+  session.endTime = start + duration;
   session.durationSeconds = duration;
-  session.synced = false;
 
-  pendingSessionCount++;
+  xSemaphoreTakeRecursive(ringMutex, portMAX_DELAY);
 
-  Serial.printf("Session added: %s, duration %d seconds\n", session.uuid, duration);
+  session.seq = nextSessionSeq;
+  if (ringAppend(session)) {
+    nextSessionSeq++;
+    flashWear.logicalBytes += sizeof(SessionRecord);
+    updateSyncCursor();
+    Serial.printf("Session added: %s, duration %d seconds\n", session.uuid, duration);
+  }
 
-  saveToFlash();
+  xSemaphoreGiveRecursive(ringMutex);
 }
 
-String getPendingSessionsJSON() {
-  JsonDocument doc;
+size_t writePendingSessionsJSON(char* out, size_t size) {
+  jsonArena.reset();
+  JsonDocument doc(&jsonArena);
   JsonArray arr = doc.to<JsonArray>();
 
-  for (int i = 0; i < pendingSessionCount; i++) {
-    if (!pendingSessions[i].synced) {
-      JsonObject obj = arr.add<JsonObject>();
-      obj["uuid"] = pendingSessions[i].uuid;
-      obj["startTime"] = (uint64_t)pendingSessions[i].startTime * 1000; // Convert to ms
-      obj["endTime"] = (uint64_t)pendingSessions[i].endTime * 1000;
-      obj["durationSeconds"] = pendingSessions[i].durationSeconds;
+  if (ringPartition == nullptr) {
+    return serializeJson(doc, out, size);
+  }
+
+  xSemaphoreTakeRecursive(ringMutex, portMAX_DELAY);
+
+  // Serve the next batch after what this connection has already been sent
+  uint32_t offset = syncBatchStart();
+  uint32_t slot;
+  Session session;
+  while (syncNext(&offset, &slot, &session)) {
+    // A recovered session's times belong to an earlier boot, never rebase it
+    bool timeValid = session.startTime >= MIN_VALID_EPOCH ||
+                     (!(session.flags & SESSION_FLAG_RECOVERED) && rebaseSession(&session));
+
+    JsonObject obj = arr.add<JsonObject>();
+    obj["uuid"] = session.uuid;
+    obj["seq"] = session.seq;
+    obj["startTime"] = (uint64_t)session.startTime * 1000; // Convert to ms
+    obj["endTime"] = (uint64_t)session.endTime * 1000;
+    obj["durationSeconds"] = session.durationSeconds;
+
+    // Recorded before any clock sync of its boot
+    if (!timeValid) {
+      obj["timeValid"] = false;
     }
+
+    // Ended by a power loss, the end time is the last checkpoint
+    if (session.flags & SESSION_FLAG_RECOVERED) {
+      obj["recovered"] = true;
+    }
+
+    // Stop at what fits in one read, the rest follow once these are acked
+    if (measureJson(doc) >= size) {
+      arr.remove(arr.size() - 1);
+      break;
+    }
+
+    syncServed(slot, session);
   }
 
-  String output;
-  serializeJson(doc, output);
-  return output;
+  xSemaphoreGiveRecursive(ringMutex);
+
+  return serializeJson(doc, out, size);
 }
 
-void markSessionsSynced(const char* json) {
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, json);
+void markSessionsSynced(const char* json, size_t length) {
+  jsonArena.reset();
+  JsonDocument doc(&jsonArena);
+  DeserializationError error = deserializeJson(doc, json, length);
 
   if (error) {
     Serial.println("Failed to parse sync ack JSON");
     return;
   }
 
-  JsonArray arr = doc.as<JsonArray>();
+  if (ringPartition == nullptr) {
+    return;
+  }
 
-  for (JsonVariant v : arr) {
-    const char* uuid = v.as<const char*>();
+  xSemaphoreTakeRecursive(ringMutex, portMAX_DELAY);
+
+  // Acks are idempotent (see SessionRing.cpp), a batch acked twice is harmless
+  bool ackedUpTo = false;
+  if (doc["upTo"].is<uint32_t>()) {
+    // {"upTo": seq} confirms every session up to and including seq
+    if (ackSessionsUpTo(doc["upTo"])) {
+      markDirty(DIRTY_ACKED);
+      ackedUpTo = true;
+      Serial.printf("Sessions marked synced up to seq %u\n", ringAckedUpTo);
+    }
+  } else {
+    // Array of session UUIDs, each ack programs one byte
+    JsonArray arr = doc.as<JsonArray>();
 
-    for (int i = 0; i < pendingSessionCount; i++) {
-      if (strcmp(pendingSessions[i].uuid, uuid) == 0) {
-        pendingSessions[i].synced = true;
+    for (JsonVariant v : arr) {
+      const char* uuid = v.as<const char*>();
+      if (uuid != nullptr && ackSession(uuid)) {
+        flashWear.logicalBytes += 1;
         Serial.printf("Session marked synced: %s\n", uuid);
-        break;
       }
     }
   }
 
-  // Clean up synced sessions
-  int writeIndex = 0;
-  for (int i = 0; i < pendingSessionCount; i++) {
-    if (!pendingSessions[i].synced) {
-      if (writeIndex != i) {
-        pendingSessions[writeIndex] = pendingSessions[i];
-      }
-      writeIndex++;
+  syncAcked();
+
+  xSemaphoreGiveRecursive(ringMutex);
+
+  // The mark lives only in the journal, so it is committed now like the
+  // byte a UUID ack programs, not after the quiet period. A reset in that
+  // window would serve the batch again.
+  if (ackedUpTo) {
+    flushStorage(true);
+  }
+}
+
+bool rebaseSession(Session* session) {
+  // Convert seconds since boot to Unix seconds if that boot was later synced
+  for (int i = 0; i < clockRebaseCount; i++) {
+    if (session->seq >= clockRebases[i].firstSeq && session->seq <= clockRebases[i].lastSeq) {
+      session->startTime = ((int64_t)session->startTime * 1000 + clockRebases[i].offsetMs) / 1000;
+      session->endTime = ((int64_t)session->endTime * 1000 + clockRebases[i].offsetMs) / 1000;
+      return true;
+    }
+  }
+  return false;
+}
+
+void addClockRebase(const ClockRebase& rebase) {
+  // Replayed records may repeat after a reclaim, the same range replaces
+  for (int i = 0; i < clockRebaseCount; i++) {
+    if (clockRebases[i].firstSeq == rebase.firstSeq) {
+      clockRebases[i] = rebase;
+      return;
     }
   }
-  pendingSessionCount = writeIndex;
 
-  saveToFlash();
+  if (clockRebaseCount == MAX_CLOCK_REBASES) {
+    for (int i = 0; i < MAX_CLOCK_REBASES - 1; i++) {
+      clockRebases[i] = clockRebases[i + 1];
+    }
+    clockRebaseCount--;
+  }
+  clockRebases[clockRebaseCount++] = rebase;
 }
 
 // =============================================================================
 // PLAN STORAGE
 // =============================================================================
 
-void storePlans(const char* json) {
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, json);
+void storePlans(const char* json, size_t length) {
+  jsonArena.reset();
+  JsonDocument doc(&jsonArena);
+  DeserializationError error = deserializeJson(doc, json, length);
 
   if (error) {
     Serial.println("Failed to parse plans JSON");
@@ -694,79 +2434,1163 @@ void storePlans(const char* json) {
     todaysPlan.enforceGoal = plan["enforceGoal"] | false;
     todaysPlan.active = true;
 
-    Serial.printf("Plan received: %d minutes, enforce=%d\n",
-                  todaysPlan.durationMinutes, todaysPlan.enforceGoal);
+    // Breathing pattern for the session, unknown names keep the default
+    int pattern = findPattern(plan["pattern"] | PATTERNS[0].name);
+    sessionPattern = pattern >= 0 ? pattern : 0;
+
+    // Eyes-closed practice swaps the breathing light for haptic ticks
+    const char* guidance = plan["guidance"] | GUIDANCE_NAMES[0];
+    sessionGuidance = strcmp(guidance, GUIDANCE_NAMES[(uint8_t)Guidance::HAPTIC]) == 0
+                        ? Guidance::HAPTIC : Guidance::LIGHT;
+
+    // Interval bells: a repeating interval and one-off times, in seconds
+    uint32_t every = plan["bellEvery"] | 0;
+    bellSchedule.everySeconds = every >= BELL_MIN_INTERVAL_S ? min(every, (uint32_t)UINT16_MAX) : 0;
+    bellSchedule.count = 0;
+    for (JsonVariant at : plan["bellsAt"].as<JsonArray>()) {
+      uint32_t seconds = at | 0;
+      if (seconds > 0 && seconds <= UINT16_MAX && bellSchedule.count < MAX_BELL_TIMES) {
+        bellSchedule.atSeconds[bellSchedule.count++] = seconds;
+      }
+    }
+
+    Serial.printf("Plan received: %d minutes, enforce=%d, pattern %s, guidance %s\n",
+                  todaysPlan.durationMinutes, todaysPlan.enforceGoal,
+                  sessionPattern == PATTERN_CUSTOM ? customPattern.name : PATTERNS[sessionPattern].name,
+                  GUIDANCE_NAMES[(uint8_t)sessionGuidance]);
   } else {
     todaysPlan.active = false;
+    sessionPattern = 0;
+    sessionGuidance = Guidance::LIGHT;
+    bellSchedule = {0, 0, 0, {}};
   }
 
-  saveToFlash();
+  // A running session picks up the new bells
+  if (currentState == State::ACTIVE) {
+    scheduleBell();
+  }
+
+  markDirty(DIRTY_PLAN);
 }
 
 void storeTotalHours(uint32_t total) {
   totalSeconds = total;
-  saveToFlash();
+  markDirty(DIRTY_TOTAL);
   Serial.printf("Total hours updated: %d seconds\n", total);
 }
 
 // =============================================================================
-// FLASH STORAGE
+// PATTERN STORAGE
 // =============================================================================
 
-void loadFromFlash() {
-  preferences.begin(PREFS_NAMESPACE, true); // Read-only
+// The app uploads one breath pattern as a single little-endian write that
+// fits even a 128-byte MTU:
+//
+//   0  format (PATTERN_FORMAT)   1  keyframe count   2  loop start or 0xFF
+//   3  reserved                  4  cycle ms (uint16), 0 keeps the durations
+//   6  keyframes, 7 bytes each: red, green, blue, level, easing, ms (uint16)
+//
+// A non-zero cycle rescales the looped keyframes (all of them for a pattern
+// that plays once) to that total, so the band can follow the app's breath
+// clock without a new keyframe list. The bytes are kept as sent in NVS and
+// parsed again at boot.
+
+bool storePattern(const uint8_t* data, size_t length) {
+  // An empty write removes the pattern
+  Keyframe keys[PATTERN_MAX_KEYFRAMES];
+  Pattern pattern = {customPattern.name, customKeys, 0, PATTERN_NO_LOOP};
+  if (length > 0 && !parsePattern(data, length, keys, &pattern)) {
+    return false;
+  }
 
-  totalSeconds = preferences.getUInt("totalSec", 0);
-  pendingSessionCount = preferences.getInt("pendingCnt", 0);
+  xSemaphoreTakeRecursive(ledMutex, portMAX_DELAY);
 
-  if (pendingSessionCount > 0 && pendingSessionCount <= MAX_PENDING_SESSIONS) {
-    preferences.getBytes("sessions", pendingSessions,
-                        sizeof(Session) * pendingSessionCount);
-  } else {
-    pendingSessionCount = 0;
+  memcpy(customKeys, keys, pattern.count * sizeof(Keyframe));
+  customPattern = pattern;
+  memcpy(customPatternBytes, data, length);
+  customPatternLength = length;
+
+  // An upload is also the choice of pattern, and takes over a running breath
+  sessionPattern = length > 0 ? PATTERN_CUSTOM : 0;
+  markDirty(DIRTY_PLAN);
+  if (currentState == State::ACTIVE && ledPattern != &START_FLASH) {
+    playPattern(selectedPattern());
   }
 
+  xSemaphoreGiveRecursive(ledMutex);
+
+  preferences.begin(PREFS_NAMESPACE, false); // Read-write
+  if (length > 0) {
+    preferences.putBytes("pattern", data, length);
+  } else {
+    preferences.remove("pattern");
+  }
   preferences.end();
 
-  Serial.printf("Loaded: %d total seconds, %d pending sessions\n",
-                totalSeconds, pendingSessionCount);
+  Serial.printf("Pattern stored: %u keyframes, loop from %u\n", pattern.count, pattern.loopStart);
+  return true;
 }
 
-void saveToFlash() {
-  preferences.begin(PREFS_NAMESPACE, false); // Read-write
+bool parsePattern(const uint8_t* data, size_t length, Keyframe* keys, Pattern* pattern) {
+  if (length < PATTERN_HEADER_BYTES || data[0] != PATTERN_FORMAT) {
+    Serial.println("Pattern rejected: unknown format");
+    return false;
+  }
+
+  uint8_t count = data[1];
+  uint8_t loopStart = data[2];
+  uint16_t cycleMs = data[4] | (data[5] << 8);
+  if (count == 0 || count > PATTERN_MAX_KEYFRAMES ||
+      length != PATTERN_HEADER_BYTES + (size_t)count * PATTERN_KEYFRAME_BYTES ||
+      (loopStart >= count && loopStart != PATTERN_NO_LOOP)) {
+    Serial.println("Pattern rejected: bad length or loop start");
+    return false;
+  }
+
+  uint8_t first = loopStart == PATTERN_NO_LOOP ? 0 : loopStart;
+  uint32_t spanMs = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    const uint8_t* key = data + PATTERN_HEADER_BYTES + i * PATTERN_KEYFRAME_BYTES;
+    if (key[4] > (uint8_t)Easing::SINE) {
+      Serial.println("Pattern rejected: unknown easing");
+      return false;
+    }
+
+    // Uploaded patterns stay within the breath power budget
+    keys[i].color = ((uint32_t)key[0] << 16) | (key[1] << 8) | key[2];
+    keys[i].level = min(key[3], (uint8_t)LED_BRIGHTNESS_MAX);
+    keys[i].easing = (Easing)key[4];
+    keys[i].durationMs = key[5] | (key[6] << 8);
+    if (i >= first) {
+      spanMs += keys[i].durationMs;
+    }
+  }
 
-  preferences.putUInt("totalSec", totalSeconds);
-  preferences.putInt("pendingCnt", pendingSessionCount);
+  if (spanMs == 0) {
+    Serial.println("Pattern rejected: zero length cycle");
+    return false;
+  }
 
-  if (pendingSessionCount > 0) {
-    preferences.putBytes("sessions", pendingSessions,
-                        sizeof(Session) * pendingSessionCount);
+  if (cycleMs > 0) {
+    // Scale each boundary rather than each duration so rounding cannot drift
+    uint32_t elapsed = 0;
+    uint32_t scaledBefore = 0;
+    for (uint8_t i = first; i < count; i++) {
+      elapsed += keys[i].durationMs;
+      uint32_t scaled = ((uint64_t)elapsed * cycleMs + spanMs / 2) / spanMs;
+      keys[i].durationMs = scaled - scaledBefore;
+      scaledBefore = scaled;
+    }
   }
 
+  pattern->count = count;
+  pattern->loopStart = loopStart;
+  return true;
+}
+
+void loadPattern() {
+  preferences.begin(PREFS_NAMESPACE, true); // Read-only
+  size_t length = preferences.getBytesLength("pattern");
+  if (length > 0 && length <= PATTERN_MAX_BYTES) {
+    preferences.getBytes("pattern", customPatternBytes, length);
+    if (parsePattern(customPatternBytes, length, customKeys, &customPattern)) {
+      customPatternLength = length;
+    }
+  }
   preferences.end();
 }
 
 // =============================================================================
-// UTILITIES
+// HAPTIC STORAGE
 // =============================================================================
 
-String generateUUID() {
-  // Simple pseudo-random UUID v4
-  // In production, use proper random source
-  char uuid[37];
+// The app replaces the pattern for one haptic event per write:
+//
+//   0  format (HAPTIC_FORMAT)    1  event (HapticEvent)
+//   2  step count, 0 restores the built-in    3  kick ms, 0 for the default
+//   4  steps, 4 bytes each: op, amplitude, ms (uint16)
+//
+// A LOOP step's amplitude is the step to go back to and its ms the number
+// of extra passes. The two bytes {0, event} instead play that event's
+// pattern as it stands, so the app can preview it. Each event's bytes are
+// kept in NVS and parsed again at boot.
+
+bool storeHaptic(const uint8_t* data, size_t length) {
+  if (length == 2 && data[0] == 0 && data[1] < HAPTIC_EVENT_COUNT) {
+    playHaptic((HapticEvent)data[1]);
+    return true;
+  }
 
-  uint32_t r1 = esp_random();
-  uint32_t r2 = esp_random();
-  uint32_t r3 = esp_random();
-  uint32_t r4 = esp_random();
+  HapticStep steps[HAPTIC_MAX_STEPS];
+  uint8_t count = 0;
+  uint8_t kickMs = 0;
+  if (!parseHaptic(data, length, steps, &count, &kickMs)) {
+    return false;
+  }
 
-  snprintf(uuid, sizeof(uuid),
-           "%08x-%04x-4%03x-%04x-%012llx",
-           r1,
-           (uint16_t)(r2 >> 16),
-           (uint16_t)(r2 & 0x0FFF),
+  uint8_t event = data[1];
+  xSemaphoreTakeRecursive(hapticMutex, portMAX_DELAY);
+  // Not while it is playing
+  if (hapticPattern == &customHaptics[event]) {
+    esp_timer_stop(hapticTimer);
+    setMotor(0);
+    hapticDone();
+  }
+  memcpy(customHapticSteps[event], steps, count * sizeof(HapticStep));
+  customHaptics[event].count = count;
+  customHaptics[event].kickMs = kickMs;
+  xSemaphoreGiveRecursive(hapticMutex);
+
+  char key[] = "haptic0";
+  key[6] += event;
+  preferences.begin(PREFS_NAMESPACE, false); // Read-write
+  if (count > 0) {
+    preferences.putBytes(key, data, length);
+  } else {
+    preferences.remove(key);
+  }
+  preferences.end();
+
+  Serial.printf("Haptic pattern for %s: %u steps, %u ms kick\n",
+                HAPTIC_EVENT_NAMES[event], count, kickMs);
+  return true;
+}
+
+bool parseHaptic(const uint8_t* data, size_t length, HapticStep* steps, uint8_t* count,
+                 uint8_t* kickMs) {
+  if (length < HAPTIC_HEADER_BYTES || data[0] != HAPTIC_FORMAT || data[1] >= HAPTIC_EVENT_COUNT) {
+    Serial.println("Haptic pattern rejected: unknown format or event");
+    return false;
+  }
+
+  uint8_t n = data[2];
+  if (n > HAPTIC_MAX_STEPS || length != HAPTIC_HEADER_BYTES + (size_t)n * HAPTIC_STEP_BYTES) {
+    Serial.println("Haptic pattern rejected: bad length");
+    return false;
+  }
+
+  if (data[3] > HAPTIC_MAX_KICK_MS) {
+    Serial.println("Haptic pattern rejected: kick too long");
+    return false;
+  }
+
+  for (uint8_t i = 0; i < n; i++) {
+    const uint8_t* step = data + HAPTIC_HEADER_BYTES + i * HAPTIC_STEP_BYTES;
+    steps[i].op = (HapticOp)step[0];
+    steps[i].amplitude = step[1];
+    steps[i].durationMs = step[2] | (step[3] << 8);
+
+    // Loops only go back, so every pattern ends
+    if (step[0] > (uint8_t)HapticOp::LOOP ||
+        (steps[i].op == HapticOp::LOOP && steps[i].amplitude >= i)) {
+      Serial.println("Haptic pattern rejected: bad step");
+      return false;
+    }
+  }
+
+  // Walk it as the player would to bound how long it buzzes
+  uint32_t loops[HAPTIC_MAX_STEPS] = {};
+  uint32_t totalMs = 0;
+  uint32_t visits = 0;
+  uint8_t i = 0;
+  while (i < n) {
+    if (++visits > 4096 || totalMs > HAPTIC_MAX_MS) {
+      Serial.println("Haptic pattern rejected: plays too long");
+      return false;
+    }
+    if (steps[i].op == HapticOp::LOOP) {
+      if (loops[i] == 0) {
+        loops[i] = steps[i].durationMs + 1;
+      }
+      i = --loops[i] > 0 ? steps[i].amplitude : i + 1;
+    } else {
+      totalMs += steps[i].durationMs;
+      i++;
+    }
+  }
+  if (totalMs > HAPTIC_MAX_MS) {
+    Serial.println("Haptic pattern rejected: plays too long");
+    return false;
+  }
+
+  *count = n;
+  *kickMs = data[3];
+  return true;
+}
+
+void loadHaptics() {
+  uint8_t data[HAPTIC_MAX_BYTES];
+  char key[] = "haptic0";
+
+  preferences.begin(PREFS_NAMESPACE, true); // Read-only
+  for (int event = 0; event < HAPTIC_EVENT_COUNT; event++) {
+    key[6] = '0' + event;
+    size_t length = preferences.getBytesLength(key);
+    if (length >= HAPTIC_HEADER_BYTES && length <= HAPTIC_MAX_BYTES) {
+      preferences.getBytes(key, data, length);
+      if (data[1] == event) {
+        parseHaptic(data, length, customHapticSteps[event],
+                    &customHaptics[event].count, &customHaptics[event].kickMs);
+      }
+    }
+  }
+  preferences.end();
+}
+
+// =============================================================================
+// BREATH SYNC
+// =============================================================================
+
+// The app names one moment its breath cycle began, in wall clock time, and
+// the cycle length. The band keeps its own estimate of app breath time,
+// advanced by millis() at a learned rate, and each sync measures how far
+// that estimate is off. The first sync jumps to the app's phase; later ones
+// slew the error out at no more than BREATH_SLEW_MS_PER_S, so the breath
+// never visibly skips, and a small share of the error feeds the rate so the
+// lock holds between syncs and after the app disconnects.
+
+bool syncBreath(uint64_t refEpochMs, uint32_t cycleMs) {
+  if (cycleMs == 0) {
+    // Back to the band's own rhythm
+    xSemaphoreTakeRecursive(ledMutex, portMAX_DELAY);
+    breathClock.locked = false;
+    xSemaphoreGiveRecursive(ledMutex);
+    Serial.println("Breath sync stopped");
+    return true;
+  }
+
+  if (!clockSynced || cycleMs < 1000 || cycleMs > 60000) {
+    Serial.println("Ignoring breath sync without wall clock or with bad cycle");
+    return false;
+  }
+
+  xSemaphoreTakeRecursive(ledMutex, portMAX_DELAY);
+
+  uint32_t now = millis();
+  advanceBreathClock(now);
+  int64_t targetUs = ((int64_t)wallClockMs() - (int64_t)refEpochMs) * 1000;
+
+  if (!breathClock.locked || breathClock.cycleMs != cycleMs) {
+    // Acquire: take the app's phase as is, starting from the wall clock rate
+    breathClock.locked = true;
+    breathClock.cycleMs = cycleMs;
+    breathClock.appTimeUs = targetUs;
+    breathClock.slewUs = 0;
+    breathClock.ratePpm = driftPpb / 1000;
+    breathClock.syncs = 0;
+    breathClock.lastErrorMs = 0;
+    breathClock.maxErrorMs = 0;
+  } else {
+    // Error in phase, wrapped to within half a cycle
+    int64_t cycleUs = (int64_t)cycleMs * 1000;
+    int64_t errorUs = (targetUs - breathClock.appTimeUs) % cycleUs;
+    if (errorUs > cycleUs / 2) {
+      errorUs -= cycleUs;
+    } else if (errorUs < -cycleUs / 2) {
+      errorUs += cycleUs;
+    }
+    breathClock.appTimeUs = targetUs - errorUs;
+
+    // Replaces any correction still pending, the error includes it
+    breathClock.slewUs = errorUs;
+
+    uint32_t intervalMs = now - breathClock.lastSyncMs;
+    if (intervalMs >= BREATH_RATE_SPACING_MS) {
+      int64_t ratePpm = breathClock.ratePpm + errorUs * 1000 / intervalMs / BREATH_RATE_GAIN;
+      breathClock.ratePpm = constrain(ratePpm, (int64_t)-BREATH_MAX_RATE_PPM, (int64_t)BREATH_MAX_RATE_PPM);
+    }
+
+    breathClock.lastErrorMs = errorUs / 1000;
+    if (abs(breathClock.lastErrorMs) > abs(breathClock.maxErrorMs)) {
+      breathClock.maxErrorMs = breathClock.lastErrorMs;
+    }
+  }
+
+  breathClock.refEpochMs = refEpochMs;
+  breathClock.lastSyncMs = now;
+  breathClock.syncs++;
+
+  xSemaphoreGiveRecursive(ledMutex);
+
+  Serial.printf("Breath sync: %u ms cycle, error %d ms, rate %d ppm\n",
+                cycleMs, breathClock.lastErrorMs, breathClock.ratePpm);
+  return true;
+}
+
+void advanceBreathClock(uint32_t now) {
+  uint32_t elapsedMs = now - breathClock.advancedMs;
+  breathClock.advancedMs = now;
+  if (!breathClock.locked) {
+    return;
+  }
+
+  // Slew at most BREATH_SLEW_MS_PER_S, in microseconds per elapsed ms
+  int64_t step = (int64_t)elapsedMs * BREATH_SLEW_MS_PER_S;
+  step = constrain(breathClock.slewUs, -step, step);
+  breathClock.slewUs -= step;
+
+  breathClock.appTimeUs += (int64_t)elapsedMs * 1000 +
+                           (int64_t)elapsedMs * breathClock.ratePpm / 1000 + step;
+}
+
+// =============================================================================
+// WALL CLOCK
+// =============================================================================
+
+uint64_t monotonicMs() {
+  // 64-bit microsecond timer, does not wrap like millis()
+  return (uint64_t)esp_timer_get_time() / 1000;
+}
+
+uint64_t wallClockMs() {
+  if (!clockSynced) {
+    return 0;
+  }
+  return monoToEpochMs(monotonicMs());
+}
+
+uint64_t monoToEpochMs(uint64_t monoMs) {
+  // Extrapolate from the last sync, correcting for the estimated clock drift
+  int64_t delta = (int64_t)monoMs - (int64_t)anchorMonoMs;
+  int64_t correction = delta * driftPpb / 1000000000LL;
+  return (uint64_t)((int64_t)anchorEpochMs + delta + correction);
+}
+
+uint32_t sessionTimestamp(uint64_t monoMs) {
+  // Unix seconds once synced, otherwise seconds since boot (rebased on sync)
+  if (!clockSynced) {
+    return monoMs / 1000;
+  }
+  return (uint32_t)(monoToEpochMs(monoMs) / 1000);
+}
+
+void setWallClock(uint64_t epochMs) {
+  if (epochMs / 1000 < MIN_VALID_EPOCH) {
+    Serial.println("Ignoring invalid wall clock");
+    return;
+  }
+
+  uint64_t nowMono = monotonicMs();
+
+  // How far the drift-corrected clock had wandered since the last sync
+  if (clockSynced) {
+    lastSyncErrorMs = (int32_t)((int64_t)monoToEpochMs(nowMono) - (int64_t)epochMs);
+    trace(TraceEvent::CLOCK_SYNC, (uint32_t)lastSyncErrorMs);
+  }
+
+  // Record a regression point, keeping them spaced so BLE jitter doesn't dominate
+  TimeSync sync = {nowMono, (int64_t)epochMs - (int64_t)nowMono};
+  if (timeSyncCount > 0 &&
+      nowMono - timeSyncs[timeSyncCount - 1].monoMs < MIN_SYNC_SPACING_MS) {
+    // Too close to the previous point, just re-anchor
+  } else {
+    if (timeSyncCount == MAX_TIME_SYNCS) {
+      for (int i = 0; i < MAX_TIME_SYNCS - 1; i++) {
+        timeSyncs[i] = timeSyncs[i + 1];
+      }
+      timeSyncCount--;
+    }
+    timeSyncs[timeSyncCount++] = sync;
+    estimateDrift();
+  }
+
+  bool wasSynced = clockSynced;
+  anchorMonoMs = nowMono;
+  anchorEpochMs = epochMs;
+  clockSynced = true;
+
+  // A session in progress can now be checkpointed with its real start
+  if (currentState == State::ACTIVE && sessionStartEpoch == 0) {
+    sessionStartEpoch = (epochMs - (uint64_t)(millis() - sessionStartTime)) / 1000;
+  }
+
+  // Sessions recorded this boot before the clock was known are rebased
+  // when they are read, using the offset recorded here
+  if (!wasSynced && nextSessionSeq > bootFirstSeq) {
+    ClockRebase rebase = {bootFirstSeq, nextSessionSeq - 1,
+                          (int64_t)epochMs - (int64_t)nowMono};
+    addClockRebase(rebase);
+    journalCommit(RecordType::REBASE, &rebase, sizeof(rebase));
+  }
+
+  Serial.printf("Wall clock set: %llu ms (error %d ms)\n",
+                (unsigned long long)epochMs, lastSyncErrorMs);
+}
+
+void estimateDrift() {
+  // Least-squares slope of (epoch - monotonic) against monotonic time.
+  // Only runs on sync, so doubles are fine here.
+  if (timeSyncCount < 2) {
+    return;
+  }
+
+  double meanX = 0, meanY = 0;
+  for (int i = 0; i < timeSyncCount; i++) {
+    meanX += (double)(timeSyncs[i].monoMs - timeSyncs[0].monoMs);
+    meanY += (double)(timeSyncs[i].offsetMs - timeSyncs[0].offsetMs);
+  }
+  meanX /= timeSyncCount;
+  meanY /= timeSyncCount;
+
+  double sxx = 0, sxy = 0;
+  for (int i = 0; i < timeSyncCount; i++) {
+    double dx = (double)(timeSyncs[i].monoMs - timeSyncs[0].monoMs) - meanX;
+    double dy = (double)(timeSyncs[i].offsetMs - timeSyncs[0].offsetMs) - meanY;
+    sxx += dx * dx;
+    sxy += dx * dy;
+  }
+  if (sxx <= 0) {
+    return;
+  }
+
+  double slope = sxy / sxx;
+  double stdError;
+
+  if (timeSyncCount > 2) {
+    double ssr = 0;
+    for (int i = 0; i < timeSyncCount; i++) {
+      double dx = (double)(timeSyncs[i].monoMs - timeSyncs[0].monoMs) - meanX;
+      double dy = (double)(timeSyncs[i].offsetMs - timeSyncs[0].offsetMs) - meanY;
+      double residual = dy - slope * dx;
+      ssr += residual * residual;
+    }
+    stdError = sqrt(ssr / (timeSyncCount - 2) / sxx);
+  } else {
+    // Two points: bound by the sync jitter over the span
+    stdError = 2.0 * SYNC_JITTER_MS /
+               (double)(timeSyncs[1].monoMs - timeSyncs[0].monoMs);
+  }
+
+  driftPpb = (int32_t)(slope * 1e9);
+  driftUncertaintyPpb = (int32_t)(stdError * 1e9);
+
+  Serial.printf("Clock drift: %.2f ppm +/- %.2f ppm (%d syncs)\n",
+                driftPpb / 1000.0f, driftUncertaintyPpb / 1000.0f, timeSyncCount);
+
+  // Persist so the next boot starts from the learned oscillator error
+  saveSettings();
+}
+
+// =============================================================================
+// FLASH STORAGE
+// =============================================================================
+
+void loadFromFlash() {
+  preferences.begin(PREFS_NAMESPACE, true); // Read-only
+
+  driftPpb = preferences.getInt("driftPpb", 0);
+  driftUncertaintyPpb = preferences.getInt("driftUnc", -1);
+
+  preferences.end();
+
+  // The journal first, the ring needs its acked high-water mark. An empty
+  // journal on a device that has run older firmware picks up the sessions
+  // and total it left in NVS.
+  bool migrate = mountJournal() && journalUsedSectors == 0;
+  mountSessions();
+  if (migrate) {
+    migrateFromPreferences();
+  }
+
+  bootFirstSeq = nextSessionSeq;
+  updateSyncCursor();
+  syncResume();
+
+  logMount(&traceLog);
+  logMount(&statsLog);
+  statsRecordBoot();
+  loadPattern();
+  loadHaptics();
+
+  Serial.printf("Loaded: %d total seconds, %d pending sessions\n",
+                totalSeconds, pendingSessionCount);
+}
+
+void saveSettings() {
+  // Small, rarely-changing values stay in NVS
+  preferences.begin(PREFS_NAMESPACE, false); // Read-write
+
+  preferences.putInt("driftPpb", driftPpb);
+  preferences.putInt("driftUnc", driftUncertaintyPpb);
+
+  preferences.end();
+}
+
+void migrateFromPreferences() {
+  preferences.begin(PREFS_NAMESPACE, false); // Read-write
+
+  if (!preferences.isKey("totalSec")) {
+    preferences.end();
+    return;
+  }
+
+  totalSeconds = preferences.getUInt("totalSec", 0);
+  nextSessionSeq = preferences.getUInt("nextSeq", 1);
+  int count = preferences.getInt("pendingCnt", 0);
+
+  // Runs before BLE starts, so the JSON arena is free to hold the old list
+  static_assert(sizeof(NvsSession) * NVS_MAX_SESSIONS <= JSON_ARENA_SIZE,
+                "NVS session list must fit in the JSON arena");
+  NvsSession* sessions = (NvsSession*)jsonArenaBuffer;
+
+  if (count > 0 && count <= NVS_MAX_SESSIONS) {
+    size_t blobSize = preferences.getBytesLength("sessions");
+
+    if (blobSize == sizeof(NvsSession) * count) {
+      preferences.getBytes("sessions", sessions, blobSize);
+    } else if (blobSize == sizeof(LegacySession) * count) {
+      // Before sequence numbers: widen in place, last record first so
+      // nothing unread is overwritten, and number them in stored order
+      preferences.getBytes("sessions", sessions, blobSize);
+      for (int i = count - 1; i >= 0; i--) {
+        LegacySession legacy;
+        memcpy(&legacy, (uint8_t*)sessions + i * sizeof(LegacySession),
+               sizeof(LegacySession));
+
+        NvsSession& session = sessions[i];
+        memcpy(session.uuid, legacy.uuid, sizeof(session.uuid));
+        session.seq = nextSessionSeq + i;
+        session.startTime = legacy.startTime;
+        session.endTime = legacy.endTime;
+        session.durationSeconds = legacy.durationSeconds;
+        session.synced = false;
+      }
+      nextSessionSeq += count;
+    } else {
+      count = 0;
+    }
+  } else {
+    count = 0;
+  }
+
+  // Write everything to flash before dropping the NVS copy
+  for (int i = 0; i < count; i++) {
+    Session session;
+    memcpy(session.uuid, sessions[i].uuid, sizeof(session.uuid));
+    session.flags = 0;
+    session.seq = sessions[i].seq;
+    session.startTime = sessions[i].startTime;
+    session.endTime = sessions[i].endTime;
+    session.durationSeconds = sessions[i].durationSeconds;
+    if (ringAppend(session)) {
+      flashWear.logicalBytes += sizeof(SessionRecord);
+    }
+  }
+  markDirty(DIRTY_TOTAL);
+  flushStorage(true);
+
+  preferences.remove("totalSec");
+  preferences.remove("nextSeq");
+  preferences.remove("pendingCnt");
+  preferences.remove("sessions");
+  preferences.end();
+
+  Serial.printf("Migrated %d sessions from NVS\n", count);
+}
+
+// =============================================================================
+// STORAGE CACHE
+// =============================================================================
+
+// A sync writes the plan, total and acks within milliseconds of each other.
+// Plan, total and drop counter are changed in RAM and marked dirty, then
+// committed as one STATE record once writes have been quiet for
+// STORAGE_QUIET_MS. Session end and upTo acks commit immediately; anything
+// else lost to a power cut inside the window is resent by the app on the
+// next sync.
+
+void markDirty(uint8_t fields) {
+  dirtyState |= fields;
+  lastStateChange = millis();
+}
+
+void flushStorage(bool immediate) {
+  if (dirtyState == 0 ||
+      (!immediate && millis() - lastStateChange < STORAGE_QUIET_MS)) {
+    return;
+  }
+
+  xSemaphoreTakeRecursive(journalMutex, portMAX_DELAY);
+
+  uint8_t fields = dirtyState;
+  dirtyState = 0;
+  JournalState state = {totalSeconds, sessionsDropped, todaysPlan, flashCheckpoint, ringAckedUpTo, flashWear,
+                          sessionPattern, {0, 0, 0}, (uint8_t)sessionGuidance, bellSchedule, logWear};
+  journalCommit(RecordType::STATE, &state, sizeof(state));
+
+  xSemaphoreGiveRecursive(journalMutex);
+
+  Serial.printf("State committed (%s%s%s%s%s%s), %u commits since boot\n",
+                (fields & DIRTY_PLAN) ? " plan" : "",
+                (fields & DIRTY_TOTAL) ? " total" : "",
+                (fields & DIRTY_DROPPED) ? " dropped" : "",
+                (fields & DIRTY_CHECKPOINT) ? " checkpoint" : "",
+                (fields & DIRTY_ACKED) ? " acked" : "",
+                (fields & DIRTY_WEAR) ? " wear" : "",
+                stateCommitCount);
+}
+
+// Wear is counted per partition. Journal writes are commits and carry
+// their own counts forward; anything else marks the state dirty so its
+// counts reach flash with the next commit.
+
+esp_err_t flashWrite(const esp_partition_t* partition, size_t offset, const void* data, size_t length) {
+  flashWriteCount++;
+  if (partition == journalPartition) {
+    flashWear.journalBytes += length;
+  } else {
+    if (partition == ringPartition) {
+      flashWear.ringBytes += length;
+    } else if (partition == traceLog.partition) {
+      logWear.traceBytes += length;
+    } else if (partition == statsLog.partition) {
+      logWear.statsBytes += length;
+    }
+    markDirty(DIRTY_WEAR);
+  }
+  return esp_partition_write(partition, offset, data, length);
+}
+
+esp_err_t flashErase(const esp_partition_t* partition, size_t offset, size_t length) {
+  uint32_t sectors = length / FLASH_SECTOR_SIZE;
+  if (partition == journalPartition) {
+    flashWear.journalErases += sectors;
+  } else {
+    if (partition == ringPartition) {
+      flashWear.ringErases += sectors;
+    } else if (partition == traceLog.partition) {
+      logWear.traceErases += sectors;
+    } else if (partition == statsLog.partition) {
+      logWear.statsErases += sectors;
+    }
+    markDirty(DIRTY_WEAR);
+  }
+  return esp_partition_erase_range(partition, offset, length);
+}
+
+// =============================================================================
+// SESSION JOURNAL
+// =============================================================================
+
+// The journal itself is in lib/SessionJournal so it can be tested on the
+// host. The firmware mounts it on its partition, serialises access with
+// journalMutex, and gives the record types their meaning: replaying them
+// at boot and re-appending what is live when the oldest sector is
+// reclaimed.
+
+bool mountJournal() {
+  // Also guards the storage cache, so it exists even without a partition
+  journalMutex = xSemaphoreCreateRecursiveMutex();
+
+  journalPartition = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, JOURNAL_PARTITION);
+  if (journalPartition == nullptr || !journalMount(journalPartition->size)) {
+    Serial.println("No journal partition, plans and totals will not persist");
+    return false;
+  }
+
+  Serial.printf("Journal: %u of %u sectors in use\n",
+                journalUsedSectors, journalSectorCount);
+  return true;
+}
+
+bool journalCommit(RecordType type, const void* payload, uint16_t length) {
+  xSemaphoreTakeRecursive(journalMutex, portMAX_DELAY);
+  bool ok = journalAppend((uint8_t)type, payload, length);
+  xSemaphoreGiveRecursive(journalMutex);
+  return ok;
+}
+
+bool journalFlashRead(uint32_t offset, void* data, size_t length) {
+  return esp_partition_read(journalPartition, offset, data, length) == ESP_OK;
+}
+
+bool journalFlashWrite(uint32_t offset, const void* data, size_t length) {
+  return flashWrite(journalPartition, offset, data, length) == ESP_OK;
+}
+
+bool journalFlashErase(uint32_t offset, size_t length) {
+  return flashErase(journalPartition, offset, length) == ESP_OK;
+}
+
+void journalWritten(uint16_t length) {
+  stateCommitCount++;
+  flashWear.commits++;
+  flashWear.logicalBytes += length;
+}
+
+void journalApply(uint8_t type, const uint8_t* payload, uint16_t length) {
+  switch ((RecordType)type) {
+    case RecordType::PLAN:
+      if (length == sizeof(Plan)) {
+        memcpy(&todaysPlan, payload, sizeof(Plan));
+      }
+      break;
+
+    case RecordType::TOTAL:
+      if (length == sizeof(uint32_t)) {
+        memcpy(&totalSeconds, payload, sizeof(uint32_t));
+      }
+      break;
+
+    case RecordType::DROPPED:
+      if (length == sizeof(uint32_t)) {
+        memcpy(&sessionsDropped, payload, sizeof(uint32_t));
+      }
+      break;
+
+    case RecordType::REBASE:
+      if (length == sizeof(ClockRebase)) {
+        ClockRebase rebase;
+        memcpy(&rebase, payload, sizeof(ClockRebase));
+        addClockRebase(rebase);
+      }
+      break;
+
+    case RecordType::STATE:
+      // Older records are shorter, missing trailing fields read as zero
+      if (length >= offsetof(JournalState, checkpoint) && length <= sizeof(JournalState)) {
+        JournalState state;
+        memset(&state, 0, sizeof(JournalState));
+        memcpy(&state, payload, length);
+        totalSeconds = state.totalSeconds;
+        sessionsDropped = state.sessionsDropped;
+        todaysPlan = state.plan;
+        flashCheckpoint = state.checkpoint;
+        ringAckedUpTo = state.ackedUpTo;
+        flashWear = state.wear;
+        sessionPattern = state.sessionPattern <= PATTERN_CUSTOM ? state.sessionPattern : 0;
+        sessionGuidance = state.sessionGuidance == (uint8_t)Guidance::HAPTIC ? Guidance::HAPTIC : Guidance::LIGHT;
+        bellSchedule = state.bells;
+        bellSchedule.count = min(bellSchedule.count, (uint8_t)MAX_BELL_TIMES);
+        logWear = state.logWear;
+      }
+      break;
+
+    case RecordType::CHECKPOINT:
+      // Newer than the checkpoint in any STATE before it
+      if (length == sizeof(CheckpointRecord)) {
+        CheckpointRecord record;
+        memcpy(&record, payload, sizeof(CheckpointRecord));
+        flashCheckpoint.startEpoch = record.startEpoch;
+        flashCheckpoint.elapsedMs = record.elapsedMs;
+        flashCheckpoint.goalMs = record.goalMinutes * 60000;
+        flashCheckpoint.flags = record.flags;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+void journalMarkLive(uint8_t type, const uint8_t* payload, uint16_t length) {
+  switch ((RecordType)type) {
+    case RecordType::PLAN:
+    case RecordType::TOTAL:
+    case RecordType::DROPPED:
+    case RecordType::STATE:
+    case RecordType::CHECKPOINT:
+      reclaimState = true;
+      break;
+
+    case RecordType::REBASE:
+      reclaimRebases = true;
+      break;
+
+    default:
+      break;
+  }
+}
+
+void journalCarryLive() {
+  if (reclaimState) {
+    // Current values, which also commits anything still cached
+    JournalState state = {totalSeconds, sessionsDropped, todaysPlan, flashCheckpoint, ringAckedUpTo, flashWear,
+                          sessionPattern, {0, 0, 0}, (uint8_t)sessionGuidance, bellSchedule, logWear};
+    journalWrite((uint8_t)RecordType::STATE, &state, sizeof(state));
+    dirtyState = 0;
+  }
+  if (reclaimRebases) {
+    // Ranges the app has fully acknowledged are no longer needed
+    for (int i = 0; i < clockRebaseCount; i++) {
+      if (clockRebases[i].lastSeq >= syncCursor) {
+        journalWrite((uint8_t)RecordType::REBASE, &clockRebases[i], sizeof(ClockRebase));
+      }
+    }
+  }
+  reclaimState = false;
+  reclaimRebases = false;
+}
+
+// =============================================================================
+// SESSION RING
+// =============================================================================
+
+// The ring itself is in lib/SessionRing so it can be tested on the host. The
+// firmware mounts it on its partition, serialises access with ringMutex and
+// supplies flash access and overflow reporting.
+
+void mountSessions() {
+  ringPartition = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, RING_PARTITION);
+  if (ringPartition == nullptr) {
+    Serial.println("No sessions partition, sessions will not persist");
+    return;
+  }
+
+  ringMutex = xSemaphoreCreateRecursiveMutex();
+  ringMount(ringPartition->size);
+
+  if (ringIndex == nullptr) {
+    Serial.println("No memory for the session index, acks will scan the ring");
+  }
+  Serial.printf("Session ring: %d pending of %u slots\n", pendingSessionCount, ringSlotCount);
+  if (ringV1SectorCount() != 0) {
+    Serial.printf("Session ring: %u sectors in version 1 layout, migrating as the ring wraps\n",
+                  ringV1SectorCount());
+  }
+}
+
+bool ringFlashRead(uint32_t offset, void* data, size_t length) {
+  return esp_partition_read(ringPartition, offset, data, length) == ESP_OK;
+}
+
+bool ringFlashWrite(uint32_t offset, const void* data, size_t length) {
+  return flashWrite(ringPartition, offset, data, length) == ESP_OK;
+}
+
+bool ringFlashErase(uint32_t offset, size_t length) {
+  return flashErase(ringPartition, offset, length) == ESP_OK;
+}
+
+void ringOverflowed(uint32_t dropped, OverflowPolicy policy) {
+  sessionsDropped += dropped;
+  markDirty(DIRTY_DROPPED);
+  if (policy == OverflowPolicy::DROP_NEWEST) {
+    Serial.println("Session ring full, new session dropped");
+  } else {
+    Serial.printf("Session ring full, dropped %u oldest sessions\n", dropped);
+  }
+  trace(TraceEvent::RING_OVERFLOW, dropped);
+}
+
+void ringWriteFailed(uint32_t slot) {
+  trace(TraceEvent::RING_WRITE_FAILED, slot);
+  Serial.println("Session ring write failed");
+}
+
+void ringCountMismatch(uint32_t counted) {
+  trace(TraceEvent::RING_COUNT_MISMATCH, counted);
+  Serial.printf("Session ring counted %u pending but holds none\n", counted);
+}
+
+// =============================================================================
+// RECORD LOGS
+// =============================================================================
+
+// The trace and stats partitions hold fixed-size records written in turn
+// and never modified. The oldest sector is erased as the head enters it, so
+// a log keeps the latest (sectors - 1) sectors' worth. Unlike the session
+// ring there is nothing to acknowledge; unlike the journal there is no
+// state to carry forward on reclaim.
+
+bool logMount(LogRegion* log) {
+  log->partition = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, log->label);
+  if (log->partition == nullptr) {
+    Serial.printf("No %s partition\n", log->label);
+    return false;
+  }
+
+  if (logMutex == nullptr) {
+    logMutex = xSemaphoreCreateRecursiveMutex();
+  }
+
+  uint32_t perSector = FLASH_SECTOR_SIZE / log->recordSize;
+  uint32_t sectorCount = log->partition->size / FLASH_SECTOR_SIZE;
+  log->recordCount = sectorCount * perSector;
+  log->head = 0;
+  log->nextSeq = 1;
+
+  // The sector whose first valid record has the highest seq holds the head
+  LogRecordHeader header;
+  bool found = false;
+  uint32_t headSector = 0;
+  for (uint32_t i = 0; i < sectorCount; i++) {
+    if (logSectorFirst(log, i, &header) &&
+        (!found || header.seq >= log->nextSeq)) {
+      headSector = i;
+      log->nextSeq = header.seq + 1;
+      found = true;
+    }
+  }
+
+  if (!found) {
+    return true;
+  }
+
+  // Past the last programmed record, a torn one included
+  uint32_t sectorStart = headSector * perSector;
+  log->head = sectorStart;
+  for (uint32_t i = sectorStart; i < sectorStart + perSector; i++) {
+    bool valid = logRead(log, i, &header, nullptr, 0);
+    if (valid && header.seq >= log->nextSeq) {
+      log->nextSeq = header.seq + 1;
+    }
+    if (valid || !logRecordErased(log, i)) {
+      log->head = i + 1;
+    }
+  }
+  log->head %= log->recordCount;
+
+  return true;
+}
+
+bool logSectorFirst(LogRegion* log, uint32_t sector, LogRecordHeader* header) {
+  // A failed append leaves a spoiled record the head has moved past, so a
+  // sector's first record can't be relied on
+  uint32_t perSector = FLASH_SECTOR_SIZE / log->recordSize;
+  for (uint32_t i = sector * perSector; i < (sector + 1) * perSector; i++) {
+    if (logRead(log, i, header, nullptr, 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool logAppend(LogRegion* log, uint8_t type, const void* payload, size_t length) {
+  if (log->partition == nullptr || sizeof(LogRecordHeader) + length > log->recordSize) {
+    return false;
+  }
+
+  xSemaphoreTakeRecursive(logMutex, portMAX_DELAY);
+
+  uint32_t perSector = FLASH_SECTOR_SIZE / log->recordSize;
+  if (log->head % perSector == 0) {
+    flashErase(log->partition, (log->head / perSector) * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+  }
+
+  // Body first, then the magic byte commits it
+  uint8_t record[LOG_MAX_RECORD];
+  memset(record, 0, log->recordSize);
+  LogRecordHeader* header = (LogRecordHeader*)record;
+  header->magic = 0xFF;
+  header->type = type;
+  header->seq = log->nextSeq;
+  memcpy(record + sizeof(LogRecordHeader), payload, length);
+  header->crc = flashCRC(record + offsetof(LogRecordHeader, seq),
+                         log->recordSize - offsetof(LogRecordHeader, seq));
+
+  uint32_t offset = log->head * log->recordSize;
+  uint8_t magic = LOG_RECORD_MAGIC;
+  bool ok = flashWrite(log->partition, offset, record, log->recordSize) == ESP_OK &&
+            flashWrite(log->partition, offset, &magic, 1) == ESP_OK;
+
+  log->head = (log->head + 1) % log->recordCount;
+  log->nextSeq++;
+  flashWear.logicalBytes += length;
+
+  xSemaphoreGiveRecursive(logMutex);
+  return ok;
+}
+
+bool logRead(LogRegion* log, uint32_t index, LogRecordHeader* header, void* payload, size_t length) {
+  uint8_t record[LOG_MAX_RECORD];
+  if (log->partition == nullptr ||
+      esp_partition_read(log->partition, index * log->recordSize, record, log->recordSize) != ESP_OK) {
+    return false;
+  }
+
+  memcpy(header, record, sizeof(LogRecordHeader));
+  if (header->magic != LOG_RECORD_MAGIC ||
+      header->crc != (uint16_t)flashCRC(record + offsetof(LogRecordHeader, seq),
+                                        log->recordSize - offsetof(LogRecordHeader, seq))) {
+    return false;
+  }
+
+  memcpy(payload, record + sizeof(LogRecordHeader), length);
+  return true;
+}
+
+bool logRecordErased(LogRegion* log, uint32_t index) {
+  uint8_t record[LOG_MAX_RECORD];
+  esp_partition_read(log->partition, index * log->recordSize, record, log->recordSize);
+  for (size_t i = 0; i < log->recordSize; i++) {
+    if (record[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void trace(TraceEvent event, uint32_t arg) {
+  TraceRecord record = {(uint32_t)monotonicMs(), arg};
+  logAppend(&traceLog, (uint8_t)event, &record, sizeof(record));
+}
+
+void traceDump() {
+  uint32_t count = traceLog.nextSeq - 1 < TRACE_BOOT_DUMP ? traceLog.nextSeq - 1 : TRACE_BOOT_DUMP;
+  for (uint32_t k = count; k > 0; k--) {
+    uint32_t index = (traceLog.head + traceLog.recordCount - k) % traceLog.recordCount;
+    LogRecordHeader header;
+    TraceRecord record;
+    if (logRead(&traceLog, index, &header, &record, sizeof(record))) {
+      Serial.printf("  trace %u: event %u at %u ms, arg %d\n",
+                    header.seq, header.type, record.uptimeMs, (int32_t)record.arg);
+    }
+  }
+}
+
+void statsRecordBoot() {
+  // The newest intact record, walking back past a torn one
+  uint32_t written = statsLog.nextSeq - 1;
+  for (uint32_t k = 1; k <= written && k <= statsLog.recordCount; k++) {
+    uint32_t index = (statsLog.head + statsLog.recordCount - k) % statsLog.recordCount;
+    LogRecordHeader header;
+    if (logRead(&statsLog, index, &header, &deviceStats, sizeof(deviceStats))) {
+      break;
+    }
+  }
+
+  esp_reset_reason_t reason = esp_reset_reason();
+  deviceStats.boots++;
+  if (reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+      reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT) {
+    deviceStats.abnormalResets++;
+  }
+
+  Serial.printf("Boot %u, reset reason %d\n", deviceStats.boots, (int)reason);
+  traceDump();
+  trace(TraceEvent::BOOT, (uint32_t)reason);
+  statsSave();
+}
+
+void statsSave() {
+  logAppend(&statsLog, 0, &deviceStats, sizeof(deviceStats));
+}
+
+// =============================================================================
+// UTILITIES
+// =============================================================================
+
+uint32_t flashCRC(const void* data, size_t length) {
+  return crc32_le(0, (const uint8_t*)data, length);
+}
+
+void generateUUID(char* out) {
+  // Simple pseudo-random UUID v4 into a 37-byte buffer
+  // In production, use proper random source
+  uint32_t r1 = esp_random();
+  uint32_t r2 = esp_random();
+  uint32_t r3 = esp_random();
+  uint32_t r4 = esp_random();
+
+  snprintf(out, 37,
+           "%08x-%04x-4%03x-%04x-%012llx",
+           r1,
+           (uint16_t)(r2 >> 16),
+           (uint16_t)(r2 & 0x0FFF),
            (uint16_t)((r3 & 0x3FFF) | 0x8000),
            ((uint64_t)(r3 >> 16) << 32) | r4);
-
-  return String(uuid);
 }
@@ -0,0 +1,183 @@
+/**
+ * Host stand-in for the sessions partition, shared by the native tests.
+ *
+ * Implements the SessionRing hooks, and the SessionJournal flash hooks for
+ * tests that use it, over RAM images with NOR flash rules: programming can
+ * only clear bits and an erase sets a whole sector to 0xFF.
+ * simReboot() drops everything in RAM as a reset would, keeping only the
+ * acked high-water mark the firmware journals.
+ *
+ * Power cuts and failed writes can be injected. A cut throws PowerCut out of
+ * the flash call that was running, leaving that write part done; an erase
+ * cut short leaves the first half of its sector erased.
+ */
+
+#pragma once
+
+#include <SessionRing.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+struct PowerCut {};
+
+std::vector<uint8_t> simFlash;
+std::vector<uint8_t> simJournal;   // Empty unless a test formats it
+uint32_t simDropped = 0;           // Sessions reported lost to overflow
+uint32_t simMismatched = 0;        // Counted pending with none in the ring
+long simCutBudget = -1;            // Bytes programmed before a cut (an erase is 2), -1 never
+long simFailWrites = -1;           // Writes before one fails, -1 never
+size_t simFailBytes = 0;           // Bytes the failing write programs first
+long simUnits = 0;                 // Bytes programmed and erases (2 each) so far
+long simReads = 0;                 // Flash reads so far
+
+void simSpend(long units) {
+  if (simCutBudget >= 0 && simCutBudget < units) {
+    throw PowerCut();
+  }
+  if (simCutBudget >= 0) {
+    simCutBudget -= units;
+  }
+  simUnits += units;
+}
+
+bool simRead(const std::vector<uint8_t>& image, uint32_t offset, void* data, size_t length) {
+  if (offset + length > image.size()) {
+    return false;
+  }
+  simReads++;
+  memcpy(data, &image[offset], length);
+  return true;
+}
+
+bool simWrite(std::vector<uint8_t>& image, uint32_t offset, const void* data, size_t length) {
+  if (offset + length > image.size()) {
+    return false;
+  }
+  bool fail = simFailWrites == 0;
+  if (simFailWrites >= 0) {
+    simFailWrites--;
+  }
+  if (fail && simFailBytes < length) {
+    length = simFailBytes;
+  }
+  for (size_t i = 0; i < length; i++) {
+    simSpend(1);
+    image[offset + i] &= ((const uint8_t*)data)[i];
+  }
+  return !fail;
+}
+
+bool simErase(std::vector<uint8_t>& image, uint32_t offset, size_t length) {
+  if (offset % FLASH_SECTOR_SIZE != 0 || length % FLASH_SECTOR_SIZE != 0 ||
+      offset + length > image.size()) {
+    return false;
+  }
+  if (simCutBudget == 1) {
+    memset(&image[offset], 0xFF, length / 2);
+  }
+  simSpend(2);
+  memset(&image[offset], 0xFF, length);
+  return true;
+}
+
+bool ringFlashRead(uint32_t offset, void* data, size_t length) {
+  return simRead(simFlash, offset, data, length);
+}
+
+bool ringFlashWrite(uint32_t offset, const void* data, size_t length) {
+  return simWrite(simFlash, offset, data, length);
+}
+
+bool ringFlashErase(uint32_t offset, size_t length) {
+  return simErase(simFlash, offset, length);
+}
+
+// The journal partition, for tests that link lib/SessionJournal. Cuts and
+// failed writes are shared with the ring, as on the one flash chip.
+bool journalFlashRead(uint32_t offset, void* data, size_t length) {
+  return simRead(simJournal, offset, data, length);
+}
+
+bool journalFlashWrite(uint32_t offset, const void* data, size_t length) {
+  return simWrite(simJournal, offset, data, length);
+}
+
+bool journalFlashErase(uint32_t offset, size_t length) {
+  return simErase(simJournal, offset, length);
+}
+
+uint32_t flashCRC(const void* data, size_t length) {
+  // Same result as the ROM's crc32_le(0, data, length)
+  static uint32_t table[256];
+  if (table[1] == 0) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+      }
+      table[i] = crc;
+    }
+  }
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc = (crc >> 8) ^ table[(crc ^ ((const uint8_t*)data)[i]) & 0xFF];
+  }
+  return ~crc;
+}
+
+void ringOverflowed(uint32_t dropped, OverflowPolicy policy) {
+  simDropped += dropped;
+}
+
+void ringWriteFailed(uint32_t slot) {
+}
+
+void ringCountMismatch(uint32_t counted) {
+  simMismatched += counted;
+}
+
+void simReboot() {
+  // As loadFromFlash. ringAckedUpTo is left as the journal would restore it.
+  nextSessionSeq = 1;
+  ringMount(simFlash.size());
+  updateSyncCursor();
+  syncResume();
+}
+
+void simFormat(uint32_t size) {
+  simFlash.assign(size, 0xFF);
+  simDropped = 0;
+  simMismatched = 0;
+  simCutBudget = -1;
+  simFailWrites = -1;
+  simUnits = 0;
+  simReads = 0;
+  ringAckedUpTo = 0;
+  simReboot();
+}
+
+Session simSession(uint32_t seq) {
+  // Deterministic UUID per seq so a test can name any session
+  Session session;
+  snprintf(session.uuid, sizeof(session.uuid), "%08x-0000-4000-8000-%012x",
+           seq * 2654435761u, seq);
+  session.flags = 0;
+  session.seq = seq;
+  session.startTime = 1700000000 + seq * 3600;
+  session.durationSeconds = 600 + seq % 1200;
+  session.endTime = session.startTime + session.durationSeconds;
+  return session;
+}
+
+bool simRecord() {
+  // As addPendingSession
+  Session session = simSession(nextSessionSeq);
+  if (!ringAppend(session)) {
+    return false;
+  }
+  nextSessionSeq++;
+  updateSyncCursor();
+  return true;
+}
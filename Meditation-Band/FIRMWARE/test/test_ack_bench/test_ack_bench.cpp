@@ -0,0 +1,91 @@
+/**
+ * UUID ack cost against the number of stored sessions.
+ *
+ * Fills a simulated partition sized for 10k sessions, then times acks by
+ * UUID through the index and, with the index dropped, by scanning the
+ * ring. Timings are printed for reference; the assertions count flash
+ * reads, which don't depend on the host.
+ */
+
+#include <SessionRing.h>
+#include <unity.h>
+#include <chrono>
+#include "../ring_sim.h"
+
+#define SIM_PARTITION_SIZE   (80 * FLASH_SECTOR_SIZE)  // 10240 slots
+#define BENCH_INDEXED_ACKS   500
+#define BENCH_SCANNED_ACKS   20
+
+struct AckCost {
+  double usPerAck;
+  double readsPerAck;
+};
+
+AckCost timeAcks(uint32_t stored, int acks, bool indexed) {
+  simFormat(SIM_PARTITION_SIZE);
+  for (uint32_t i = 0; i < stored; i++) {
+    TEST_ASSERT_TRUE(simRecord());
+  }
+  TEST_ASSERT_EQUAL_INT(stored, pendingSessionCount);
+
+  // Without the table acks fall back to the scan, as when it can't be allocated
+  uint16_t* index = ringIndex;
+  if (!indexed) {
+    ringIndex = nullptr;
+  }
+
+  // Spread over the whole backlog, each one still pending
+  srand(37);
+  long reads = simReads;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < acks; i++) {
+    uint32_t seq = 1 + (uint32_t)((uint64_t)stored * i / acks) + rand() % (stored / acks);
+    TEST_ASSERT_TRUE(ackSession(simSession(seq).uuid));
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  ringIndex = index;
+  TEST_ASSERT_EQUAL_INT(stored - acks, pendingSessionCount);
+  return {std::chrono::duration<double, std::micro>(elapsed).count() / acks,
+          (double)(simReads - reads) / acks};
+}
+
+void setUp() {
+  simFormat(SIM_PARTITION_SIZE);
+}
+
+void tearDown() {
+}
+
+void test_partition_holds_10k_sessions() {
+  TEST_ASSERT_TRUE(ringSlotCount >= 10000);
+  TEST_ASSERT_NOT_NULL(ringIndex);
+}
+
+void test_ack_cost_by_backlog() {
+  const uint32_t sizes[] = {1000, 4000, 10000};
+  AckCost indexed[3];
+  for (int i = 0; i < 3; i++) {
+    indexed[i] = timeAcks(sizes[i], BENCH_INDEXED_ACKS, true);
+    AckCost scanned = timeAcks(sizes[i], BENCH_SCANNED_ACKS, false);
+
+    char line[128];
+    snprintf(line, sizeof(line), "%5u stored: %6.1f us/ack indexed (%.1f reads), %8.1f us/ack scanned (%.0f reads)",
+             sizes[i], indexed[i].usPerAck, indexed[i].readsPerAck, scanned.usPerAck, scanned.readsPerAck);
+    TEST_MESSAGE(line);
+
+    // A probe or two each, against a read of most of the ring
+    TEST_ASSERT_TRUE(indexed[i].readsPerAck <= 4);
+    TEST_ASSERT_TRUE(scanned.readsPerAck > sizes[i] / 4);
+  }
+
+  // Ten times the backlog, about the same cost per ack
+  TEST_ASSERT_TRUE(indexed[2].readsPerAck <= indexed[0].readsPerAck + 1);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_partition_holds_10k_sessions);
+  RUN_TEST(test_ack_cost_by_backlog);
+  return UNITY_END();
+}
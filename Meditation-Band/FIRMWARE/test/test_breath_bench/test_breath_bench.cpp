@@ -0,0 +1,79 @@
+/**
+ * Breath curve cost per frame, table against float sin().
+ *
+ * The renderer once took sin(phase * 2 * PI - PI / 2) in single precision
+ * every frame; it now interpolates BREATH_TABLE. The host has an FPU, so
+ * the float figure here flatters the C3, which goes through soft-float.
+ * updateLED's cost on the band is in Diagnostics (led.avgUpdateUs).
+ */
+
+#include <BreathCurve.h>
+#include <unity.h>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_FRAMES   (1 << 22)
+#define BENCH_STRIDE   40503      // Odd, so every Q16 phase comes up
+
+volatile uint32_t sink;
+
+uint32_t floatCurve(uint32_t phase) {
+  // The per-frame float version, Q16 in and out
+  float p = phase / 65536.0f;
+  return (uint32_t)((sinf(p * 2 * (float)BREATH_PI - (float)BREATH_PI / 2) + 1) / 2 * 65535);
+}
+
+template <typename Curve>
+double nsPerFrame(Curve curve) {
+  uint32_t phase = 0;
+  uint32_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+    sum += curve(phase & 0xFFFF);
+    phase += BENCH_STRIDE;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  sink = sum;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / BENCH_FRAMES;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_table_matches_the_curve() {
+  // Within a few Q16 steps of (1 - cos) / 2 at every phase, far below what
+  // an 8-bit LED channel can show
+  uint32_t worst = 0;
+  for (uint32_t phase = 0; phase < 65536; phase++) {
+    int32_t exact = (int32_t)lround((1 - cos(phase * 2 * BREATH_PI / 65536)) / 2 * 65535);
+    uint32_t error = abs((int32_t)breathCurve(phase) - exact);
+    worst = error > worst ? error : worst;
+  }
+
+  char line[64];
+  snprintf(line, sizeof(line), "worst error %u of 65535", worst);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(worst <= 8);
+}
+
+void test_frame_cost() {
+  double table = nsPerFrame(breathCurve);
+  double sine = nsPerFrame(floatCurve);
+
+  char line[96];
+  snprintf(line, sizeof(line), "%.2f ns/frame table, %.2f ns/frame float sin", table, sine);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(table > 0 && sine > 0);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_table_matches_the_curve);
+  RUN_TEST(test_frame_cost);
+  return UNITY_END();
+}
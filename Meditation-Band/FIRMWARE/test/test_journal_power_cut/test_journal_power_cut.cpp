@@ -0,0 +1,268 @@
+/**
+ * Power cuts in the session journal.
+ *
+ * A fixed script of STATE, CHECKPOINT and REBASE commits, shaped like the
+ * firmware's, runs the journal round its sectors several times, so sectors
+ * are opened and the oldest reclaimed along the way. It is cut short at
+ * every byte it programs and every erase. After the reboot the replayed
+ * state must be the last committed one, or the one being committed when the
+ * power went, and the journal must carry on from there.
+ */
+
+#include <SessionJournal.h>
+#include <SessionRing.h>
+#include <unity.h>
+#include <vector>
+#include "../ring_sim.h"
+
+#define SIM_JOURNAL_SIZE     (2 * FLASH_SECTOR_SIZE)
+#define SIM_STEPS            320    // Several sectors' worth, each opened by a reclaim
+#define SIM_MAX_REBASES      4      // As MAX_CLOCK_REBASES
+
+enum SimRecordType : uint8_t {
+  SIM_REBASE = 7,
+  SIM_STATE = 8,
+  SIM_CHECKPOINT = 9
+};
+
+// Same sizes as the firmware's records
+struct SimStateRecord {
+  uint32_t totalSeconds;
+  uint32_t ackedUpTo;
+  uint32_t checkpointMs;
+  uint8_t rest[92];
+};
+
+struct __attribute__((packed)) SimCheckpointRecord {
+  uint32_t checkpointMs;
+  uint8_t rest[8];
+};
+
+struct SimRebase {
+  uint32_t firstSeq;
+  uint32_t lastSeq;
+  int64_t offsetMs;
+};
+
+static_assert(sizeof(SimStateRecord) == 104, "STATE is 104 bytes");
+static_assert(sizeof(SimCheckpointRecord) == 12, "CHECKPOINT is 12 bytes");
+
+// Everything the journal holds, as RAM has it
+struct SimState {
+  uint32_t totalSeconds;
+  uint32_t ackedUpTo;
+  uint32_t checkpointMs;
+  std::vector<SimRebase> rebases;
+
+  bool operator==(const SimState& other) const {
+    if (totalSeconds != other.totalSeconds || ackedUpTo != other.ackedUpTo ||
+        checkpointMs != other.checkpointMs || rebases.size() != other.rebases.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < rebases.size(); i++) {
+      if (memcmp(&rebases[i], &other.rebases[i], sizeof(SimRebase)) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+SimState live;
+bool reclaimState = false;
+bool reclaimRebases = false;
+long simCommits = 0;
+
+void addRebase(SimState& state, const SimRebase& rebase) {
+  // As addClockRebase: the same range replaces, the oldest goes when full
+  for (SimRebase& existing : state.rebases) {
+    if (existing.firstSeq == rebase.firstSeq) {
+      existing = rebase;
+      return;
+    }
+  }
+  if (state.rebases.size() == SIM_MAX_REBASES) {
+    state.rebases.erase(state.rebases.begin());
+  }
+  state.rebases.push_back(rebase);
+}
+
+void journalApply(uint8_t type, const uint8_t* payload, uint16_t length) {
+  if (type == SIM_STATE && length == sizeof(SimStateRecord)) {
+    SimStateRecord record;
+    memcpy(&record, payload, sizeof(record));
+    live.totalSeconds = record.totalSeconds;
+    live.ackedUpTo = record.ackedUpTo;
+    live.checkpointMs = record.checkpointMs;
+  } else if (type == SIM_CHECKPOINT && length == sizeof(SimCheckpointRecord)) {
+    SimCheckpointRecord record;
+    memcpy(&record, payload, sizeof(record));
+    live.checkpointMs = record.checkpointMs;
+  } else if (type == SIM_REBASE && length == sizeof(SimRebase)) {
+    SimRebase rebase;
+    memcpy(&rebase, payload, sizeof(rebase));
+    addRebase(live, rebase);
+  } else {
+    TEST_FAIL_MESSAGE("Replayed a record that was never written");
+  }
+}
+
+void journalMarkLive(uint8_t type, const uint8_t* payload, uint16_t length) {
+  if (type == SIM_REBASE) {
+    reclaimRebases = true;
+  } else {
+    reclaimState = true;
+  }
+}
+
+SimStateRecord stateRecord() {
+  SimStateRecord record;
+  memset(&record, 0, sizeof(record));
+  record.totalSeconds = live.totalSeconds;
+  record.ackedUpTo = live.ackedUpTo;
+  record.checkpointMs = live.checkpointMs;
+  return record;
+}
+
+void journalCarryLive() {
+  // As the firmware: the current state, then every rebase
+  if (reclaimState) {
+    SimStateRecord record = stateRecord();
+    journalWrite(SIM_STATE, &record, sizeof(record));
+  }
+  if (reclaimRebases) {
+    for (const SimRebase& rebase : live.rebases) {
+      journalWrite(SIM_REBASE, &rebase, sizeof(rebase));
+    }
+  }
+  reclaimState = false;
+  reclaimRebases = false;
+}
+
+void journalWritten(uint16_t length) {
+  simCommits++;
+}
+
+void simJournalReboot() {
+  // As mountJournal at boot, RAM starts empty
+  live = SimState{0, 0, 0, {}};
+  reclaimState = false;
+  reclaimRebases = false;
+  TEST_ASSERT_TRUE(journalMount(simJournal.size()));
+}
+
+void simJournalFormat() {
+  simJournal.assign(SIM_JOURNAL_SIZE, 0xFF);
+  simCutBudget = -1;
+  simFailWrites = -1;
+  simUnits = 0;
+  simCommits = 0;
+  simJournalReboot();
+}
+
+struct Model {
+  SimState committed;        // As of the last append that returned
+  SimState attempt;          // With the append in progress applied
+};
+
+void commitStep(Model& model, int step) {
+  // RAM changes first and is then committed, as flushStorage and
+  // checkpointSession do, so a reclaim inside the append carries the new
+  // values forward
+  int r = rand() % 100;
+  model.attempt = model.committed;
+  if (r < 50) {
+    live.totalSeconds += 60 + rand() % 600;
+    live.ackedUpTo += rand() % 3;
+    live.checkpointMs = 0;
+    model.attempt.totalSeconds = live.totalSeconds;
+    model.attempt.ackedUpTo = live.ackedUpTo;
+    model.attempt.checkpointMs = 0;
+    SimStateRecord record = stateRecord();
+    TEST_ASSERT_TRUE(journalAppend(SIM_STATE, &record, sizeof(record)));
+  } else if (r < 85) {
+    live.checkpointMs = step * 30000;
+    model.attempt.checkpointMs = live.checkpointMs;
+    SimCheckpointRecord record;
+    memset(&record, 0, sizeof(record));
+    record.checkpointMs = live.checkpointMs;
+    TEST_ASSERT_TRUE(journalAppend(SIM_CHECKPOINT, &record, sizeof(record)));
+  } else {
+    SimRebase rebase = {(uint32_t)step, (uint32_t)step + rand() % 5, 1700000000000LL + step};
+    addRebase(live, rebase);
+    addRebase(model.attempt, rebase);
+    TEST_ASSERT_TRUE(journalAppend(SIM_REBASE, &rebase, sizeof(rebase)));
+  }
+  model.committed = model.attempt;
+}
+
+void runScript(Model& model) {
+  srand(35);
+  for (int step = 0; step < SIM_STEPS; step++) {
+    commitStep(model, step);
+  }
+}
+
+void checkRecovered(Model& model) {
+  // One or the other, nothing in between and nothing older
+  TEST_ASSERT_TRUE(live == model.committed || live == model.attempt);
+  model.committed = live;
+  model.attempt = live;
+
+  // Always an erased sector ahead of the head
+  TEST_ASSERT_TRUE(journalUsedSectors < journalSectorCount);
+  TEST_ASSERT_TRUE(journalHeadOffset <= FLASH_SECTOR_SIZE);
+}
+
+void setUp() {
+  simJournalFormat();
+}
+
+void tearDown() {
+}
+
+void test_clean_run_replays() {
+  Model model = {live, live};
+  runScript(model);
+  TEST_ASSERT_TRUE(journalSectorSeq >= 5);
+  simJournalReboot();
+  TEST_ASSERT_TRUE(live == model.committed);
+}
+
+void test_power_cut_at_every_write() {
+  // A clean run gives the number of cut points
+  Model clean = {live, live};
+  runScript(clean);
+  long units = simUnits;
+
+  for (long cut = 0; cut < units; cut++) {
+    simJournalFormat();
+    simCutBudget = cut;
+    Model model = {live, live};
+    bool wasCut = false;
+    try {
+      runScript(model);
+    } catch (const PowerCut&) {
+      wasCut = true;
+    }
+    TEST_ASSERT_TRUE(wasCut);
+
+    simCutBudget = -1;
+    simJournalReboot();
+    checkRecovered(model);
+
+    // Carries on from there, through another reclaim, and replays it all
+    for (int i = 0; i < 60; i++) {
+      commitStep(model, SIM_STEPS + i);
+    }
+    simJournalReboot();
+    checkRecovered(model);
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_clean_run_replays);
+  RUN_TEST(test_power_cut_at_every_write);
+  return UNITY_END();
+}
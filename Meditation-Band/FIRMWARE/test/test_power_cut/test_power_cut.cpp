@@ -0,0 +1,247 @@
+/**
+ * Power cuts and failed writes on the sessions partition.
+ *
+ * A fixed script of sessions, acks and sector erases is cut short at every
+ * byte it programs. After the reboot every session recorded and not acked
+ * must still be pending, nothing acked may come back, and new sessions must
+ * carry on without reusing a seq or overwriting a stored one.
+ */
+
+#include <SessionRing.h>
+#include <unity.h>
+#include <map>
+#include <set>
+#include <string>
+#include "../ring_sim.h"
+
+#define SIM_PARTITION_SIZE   (2 * FLASH_SECTOR_SIZE)
+#define SIM_STEPS            600    // Once round the ring and well into the next lap
+
+struct Model {
+  std::map<uint32_t, Session> recorded;   // Appends that returned true
+  std::set<uint32_t> acked;               // By UUID, or at or below upTo
+  std::set<uint32_t> inFlight;            // Changing when the power went
+};
+
+std::vector<Session> pendingSessions(size_t limit = SIZE_MAX) {
+  // Pending sessions, oldest first, as a full sync would read them
+  std::vector<Session> sessions;
+  uint32_t offset = 0;
+  uint32_t slot;
+  Session session;
+  while (sessions.size() < limit && syncNext(&offset, &slot, &session)) {
+    sessions.push_back(session);
+  }
+  return sessions;
+}
+
+void runScript(Model& model) {
+  // Mostly sessions, with batches acked either way and idle-time erases
+  srand(33);
+  for (int step = 0; step < SIM_STEPS; step++) {
+    int r = rand() % 100;
+    if (r < 60) {
+      model.inFlight = {nextSessionSeq};
+      Session session = simSession(nextSessionSeq);
+      if (simRecord()) {
+        model.recorded[session.seq] = session;
+      }
+    } else if (r < 85) {
+      std::vector<Session> batch = pendingSessions(8);
+      model.inFlight.clear();
+      for (const Session& session : batch) {
+        model.inFlight.insert(session.seq);
+      }
+      for (const Session& session : batch) {
+        ackSession(session.uuid);
+      }
+      syncAcked();
+      model.acked.insert(model.inFlight.begin(), model.inFlight.end());
+    } else if (r < 95) {
+      // Only the journaled mark moves, taken as committed once it returns
+      std::vector<Session> batch = pendingSessions();
+      model.inFlight.clear();
+      if (!batch.empty()) {
+        ackSessionsUpTo(batch[batch.size() / 2].seq);
+        syncAcked();
+      }
+    } else {
+      model.inFlight.clear();
+      ringPrepareSector();
+    }
+    model.inFlight.clear();
+  }
+}
+
+void checkRecovered(Model& model) {
+  std::vector<Session> pending = pendingSessions();
+  std::set<uint32_t> seen;
+  uint32_t last = 0;
+  for (const Session& session : pending) {
+    // In seq order with no repeats
+    TEST_ASSERT_TRUE(session.seq > last);
+    last = session.seq;
+    seen.insert(session.seq);
+
+    bool inFlight = model.inFlight.count(session.seq) == 1;
+    bool known = model.recorded.count(session.seq) == 1;
+    TEST_ASSERT_TRUE(known || inFlight);
+    if (known) {
+      TEST_ASSERT_EQUAL_STRING(model.recorded[session.seq].uuid, session.uuid);
+      TEST_ASSERT_EQUAL_UINT32(model.recorded[session.seq].startTime, session.startTime);
+    } else {
+      // The append finished its write before the cut
+      model.recorded[session.seq] = simSession(session.seq);
+    }
+    TEST_ASSERT_TRUE(model.acked.count(session.seq) == 0 || inFlight);
+    TEST_ASSERT_TRUE(session.seq > ringAckedUpTo);
+  }
+
+  for (auto& entry : model.recorded) {
+    uint32_t seq = entry.first;
+    if (seq > ringAckedUpTo && model.acked.count(seq) == 0 && model.inFlight.count(seq) == 0) {
+      TEST_ASSERT_TRUE(seen.count(seq) == 1);
+    }
+  }
+  TEST_ASSERT_EQUAL_INT((int)pending.size(), pendingSessionCount);
+  TEST_ASSERT_TRUE(model.recorded.empty() || nextSessionSeq > model.recorded.rbegin()->first);
+
+  // Whichever way an interrupted ack went, it must stay that way
+  for (uint32_t seq : model.inFlight) {
+    if (seen.count(seq) == 0 && model.recorded.count(seq) == 1) {
+      model.acked.insert(seq);
+    }
+  }
+  model.inFlight.clear();
+}
+
+void setUp() {
+  simFormat(SIM_PARTITION_SIZE);
+}
+
+void tearDown() {
+}
+
+void test_failed_write_in_first_slot_of_sector() {
+  // The head moves past a slot whose write failed. When that is a sector's
+  // first slot the sector must still be found by the ones after it.
+  for (size_t kept : {(size_t)0, (size_t)3, sizeof(RingSlot)}) {
+    simFormat(SIM_PARTITION_SIZE);
+    for (uint32_t i = 0; i < RING_SLOTS_PER_SECTOR; i++) {
+      TEST_ASSERT_TRUE(simRecord());
+    }
+    simFailWrites = 0;
+    simFailBytes = kept;
+    TEST_ASSERT_FALSE(simRecord());
+    for (int i = 0; i < 5; i++) {
+      TEST_ASSERT_TRUE(simRecord());
+    }
+    TEST_ASSERT_EQUAL_UINT32(RING_SLOTS_PER_SECTOR + 6, ringHead);
+
+    simReboot();
+    TEST_ASSERT_EQUAL_UINT32(RING_SLOTS_PER_SECTOR + 6, ringHead);
+    TEST_ASSERT_EQUAL_UINT32(RING_SLOTS_PER_SECTOR + 6, nextSessionSeq);
+    TEST_ASSERT_EQUAL_INT(RING_SLOTS_PER_SECTOR + 5, pendingSessionCount);
+
+    TEST_ASSERT_TRUE(simRecord());
+    simReboot();
+    std::vector<Session> pending = pendingSessions();
+    TEST_ASSERT_EQUAL_UINT32(RING_SLOTS_PER_SECTOR + 6, pending.size());
+    TEST_ASSERT_EQUAL_UINT32(RING_SLOTS_PER_SECTOR + 6, pending.back().seq);
+  }
+}
+
+void test_failed_writes_lose_only_their_own_session() {
+  srand(330);
+  Model model;
+  for (int step = 0; step < 2000; step++) {
+    if (rand() % 10 == 0) {
+      simFailWrites = rand() % 2;
+      simFailBytes = rand() % (sizeof(RingSlot) + 1);
+    }
+    Session session = simSession(nextSessionSeq);
+    if (simRecord()) {
+      model.recorded[session.seq] = session;
+    }
+    simFailWrites = -1;
+    if (rand() % 3 == 0) {
+      for (const Session& acked : pendingSessions()) {
+        ackSession(acked.uuid);
+        model.acked.insert(acked.seq);
+      }
+      syncAcked();
+    }
+    if (rand() % 50 == 0) {
+      simReboot();
+      checkRecovered(model);
+    }
+  }
+  simReboot();
+  checkRecovered(model);
+  TEST_ASSERT_EQUAL_UINT32(0, simDropped);
+}
+
+void test_pending_count_ahead_of_the_ring() {
+  // A count left too high, as by a pending byte that failed to program,
+  // must not keep the tail walking round the ring for ever
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(simRecord());
+  }
+  pendingSessionCount += 2;
+  for (const Session& session : pendingSessions()) {
+    TEST_ASSERT_TRUE(ackSession(session.uuid));
+  }
+  syncAcked();
+  TEST_ASSERT_EQUAL_INT(0, pendingSessionCount);
+  TEST_ASSERT_EQUAL_UINT32(ringHead, ringTail);
+  TEST_ASSERT_EQUAL_UINT32(2, simMismatched);
+
+  TEST_ASSERT_TRUE(simRecord());
+  std::vector<Session> pending = pendingSessions();
+  TEST_ASSERT_EQUAL_UINT32(1, pending.size());
+  TEST_ASSERT_EQUAL_UINT32(4, pending[0].seq);
+}
+
+void test_power_cut_at_every_write() {
+  // A clean run gives the number of cut points
+  Model clean;
+  runScript(clean);
+  long units = simUnits;
+  TEST_ASSERT_TRUE(nextSessionSeq > ringSlotCount + RING_SLOTS_PER_SECTOR / 2);
+  TEST_ASSERT_EQUAL_UINT32(0, simDropped);
+
+  for (long cut = 0; cut < units; cut++) {
+    simFormat(SIM_PARTITION_SIZE);
+    simCutBudget = cut;
+    Model model;
+    bool wasCut = false;
+    try {
+      runScript(model);
+    } catch (const PowerCut&) {
+      wasCut = true;
+    }
+    TEST_ASSERT_TRUE(wasCut);
+
+    simCutBudget = -1;
+    simReboot();
+    checkRecovered(model);
+
+    // Carries on from there without overwriting anything
+    for (int i = 0; i < 3; i++) {
+      Session session = simSession(nextSessionSeq);
+      TEST_ASSERT_TRUE(simRecord());
+      model.recorded[session.seq] = session;
+    }
+    simReboot();
+    checkRecovered(model);
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_failed_write_in_first_slot_of_sector);
+  RUN_TEST(test_failed_writes_lose_only_their_own_session);
+  RUN_TEST(test_pending_count_ahead_of_the_ring);
+  RUN_TEST(test_power_cut_at_every_write);
+  return UNITY_END();
+}
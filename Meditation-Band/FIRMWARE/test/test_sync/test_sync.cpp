@@ -0,0 +1,295 @@
+/**
+ * Resumable sync over a flaky link.
+ *
+ * The app reads a batch, acks it by seq or by UUID, and may lose the link
+ * at any point in between. A new connection must resume at the first
+ * session it hasn't confirmed, and acks repeated across a reconnect must
+ * change nothing.
+ */
+
+#include <SessionRing.h>
+#include <unity.h>
+#include <limits.h>
+#include <map>
+#include <string>
+#include "../ring_sim.h"
+
+#define SIM_PARTITION_SIZE   (4 * FLASH_SECTOR_SIZE)
+#define SIM_READ_BYTES       512    // As SESSIONS_BUFFER_SIZE
+
+size_t sessionJsonSize(const Session& session) {
+  // The object writePendingSessionsJSON builds for it, as measureJson counts
+  char object[192];
+  return snprintf(object, sizeof(object),
+                  "{\"uuid\":\"%s\",\"seq\":%u,\"startTime\":%llu,\"endTime\":%llu,"
+                  "\"durationSeconds\":%u}",
+                  session.uuid, session.seq, (unsigned long long)session.startTime * 1000,
+                  (unsigned long long)session.endTime * 1000, session.durationSeconds);
+}
+
+std::vector<Session> readBatch(int limit = INT_MAX) {
+  // One read of the sessions characteristic, as writePendingSessionsJSON:
+  // sessions until the array would fill the read, about 128 bytes each
+  std::vector<Session> batch;
+  size_t bytes = 2;
+  uint32_t offset = syncBatchStart();
+  uint32_t slot;
+  Session session;
+  while ((int)batch.size() < limit && syncNext(&offset, &slot, &session)) {
+    bytes += sessionJsonSize(session) + (batch.empty() ? 0 : 1);
+    if (bytes >= SIM_READ_BYTES) {
+      break;
+    }
+    batch.push_back(session);
+    syncServed(slot, session);
+  }
+  return batch;
+}
+
+bool ackUuids(const std::vector<Session>& batch) {
+  // As markSessionsSynced with a UUID array, true if any was still pending
+  bool changed = false;
+  for (const Session& session : batch) {
+    changed |= ackSession(session.uuid);
+  }
+  syncAcked();
+  return changed;
+}
+
+bool ackUpTo(uint32_t seq) {
+  bool changed = ackSessionsUpTo(seq);
+  syncAcked();
+  return changed;
+}
+
+void setUp() {
+  simFormat(SIM_PARTITION_SIZE);
+}
+
+void tearDown() {
+}
+
+void test_reads_follow_on_before_acks() {
+  for (int i = 0; i < 20; i++) {
+    TEST_ASSERT_TRUE(simRecord());
+  }
+
+  // Three fit in one read
+  std::vector<Session> first = readBatch();
+  std::vector<Session> second = readBatch();
+  TEST_ASSERT_EQUAL_UINT32(3, first.size());
+  TEST_ASSERT_EQUAL_UINT32(1, first.front().seq);
+  TEST_ASSERT_EQUAL_UINT32(3, first.back().seq);
+  TEST_ASSERT_EQUAL_UINT32(4, second.front().seq);
+  TEST_ASSERT_EQUAL_UINT32(6, second.back().seq);
+
+  // Nothing confirmed yet, so the cursor hasn't moved
+  TEST_ASSERT_EQUAL_UINT32(1, syncCursor);
+  TEST_ASSERT_EQUAL_INT(20, pendingSessionCount);
+}
+
+void test_disconnect_mid_batch_resumes_at_first_unacked() {
+  for (int i = 0; i < 20; i++) {
+    simRecord();
+  }
+
+  syncResume();
+  std::vector<Session> batch = readBatch();
+  TEST_ASSERT_TRUE(ackUpTo(batch.back().seq));
+
+  // The second batch is sent, then the link drops before its ack
+  readBatch();
+  syncResume();
+  TEST_ASSERT_EQUAL_UINT32(4, syncCursor);
+
+  batch = readBatch();
+  TEST_ASSERT_EQUAL_UINT32(4, batch.front().seq);
+  TEST_ASSERT_EQUAL_UINT32(6, batch.back().seq);
+}
+
+void test_partial_uuid_ack_resends_only_the_rest() {
+  for (int i = 0; i < 12; i++) {
+    simRecord();
+  }
+
+  // The link dropped after the app confirmed part of two batches, out of
+  // order
+  std::vector<Session> first = readBatch();
+  std::vector<Session> second = readBatch();
+  ackUuids({first[1], first[2], second[2]});
+  syncResume();
+  TEST_ASSERT_EQUAL_UINT32(1, syncCursor);
+
+  // The nine left take three reads
+  std::vector<uint32_t> seqs;
+  for (int i = 0; i < 3; i++) {
+    for (const Session& session : readBatch()) {
+      seqs.push_back(session.seq);
+    }
+  }
+  std::vector<uint32_t> expected = {1, 4, 5, 7, 8, 9, 10, 11, 12};
+  TEST_ASSERT_TRUE(seqs == expected);
+}
+
+void test_up_to_ack_is_idempotent() {
+  for (int i = 0; i < 20; i++) {
+    simRecord();
+  }
+
+  readBatch();
+  TEST_ASSERT_TRUE(ackUpTo(3));
+  TEST_ASSERT_EQUAL_INT(17, pendingSessionCount);
+
+  // Repeated after a reconnect, or a stale lower mark, changes nothing
+  syncResume();
+  TEST_ASSERT_FALSE(ackUpTo(3));
+  TEST_ASSERT_FALSE(ackUpTo(1));
+  TEST_ASSERT_EQUAL_INT(17, pendingSessionCount);
+  TEST_ASSERT_EQUAL_UINT32(3, ringAckedUpTo);
+  TEST_ASSERT_EQUAL_UINT32(4, syncCursor);
+
+  // A mark past anything recorded stops at the newest session
+  TEST_ASSERT_TRUE(ackUpTo(1000));
+  TEST_ASSERT_EQUAL_UINT32(20, ringAckedUpTo);
+  TEST_ASSERT_EQUAL_INT(0, pendingSessionCount);
+  TEST_ASSERT_EQUAL_UINT32(nextSessionSeq, syncCursor);
+
+  // Sessions recorded later are not covered by the old mark
+  simRecord();
+  TEST_ASSERT_EQUAL_INT(1, pendingSessionCount);
+  TEST_ASSERT_EQUAL_UINT32(21, readBatch().front().seq);
+}
+
+void test_uuid_ack_is_idempotent() {
+  for (int i = 0; i < 10; i++) {
+    simRecord();
+  }
+
+  std::vector<Session> batch = readBatch();
+  TEST_ASSERT_TRUE(ackUuids(batch));
+  TEST_ASSERT_EQUAL_INT(7, pendingSessionCount);
+
+  // The same acks again, again after an upTo covering them, and one never
+  // recorded
+  TEST_ASSERT_FALSE(ackUuids(batch));
+  ackUpTo(3);
+  TEST_ASSERT_FALSE(ackUuids(batch));
+  TEST_ASSERT_FALSE(ackUuids({simSession(500)}));
+  TEST_ASSERT_EQUAL_INT(7, pendingSessionCount);
+  TEST_ASSERT_EQUAL_UINT32(4, syncCursor);
+}
+
+void test_resume_point_survives_reboot() {
+  for (int i = 0; i < 20; i++) {
+    simRecord();
+  }
+
+  std::vector<Session> batch = readBatch();
+  ackUpTo(batch.back().seq);
+  batch = readBatch();
+  ackUuids({batch[0], batch[1]});
+
+  simReboot();
+  TEST_ASSERT_EQUAL_UINT32(6, syncCursor);
+  TEST_ASSERT_EQUAL_INT(15, pendingSessionCount);
+  TEST_ASSERT_EQUAL_UINT32(6, readBatch().front().seq);
+  TEST_ASSERT_EQUAL_UINT32(21, nextSessionSeq);
+}
+
+void test_flaky_link() {
+  // Random sessions, reads, acks, dropped links and resets. The app keeps
+  // what it receives by UUID; in the end it must hold every session exactly
+  // as recorded, and each reconnect must start at the oldest unconfirmed.
+  srand(29);
+  std::map<std::string, uint32_t> app;
+  std::map<uint32_t, Session> recorded;
+  std::map<uint32_t, bool> uuidAcked;
+  uint32_t upTo = 0;
+  uint32_t journaledUpTo = 0;
+
+  for (int step = 0; step < 4000; step++) {
+    int r = rand() % 100;
+    if (r < 30 && pendingSessionCount < 90) {
+      Session session = simSession(nextSessionSeq);
+      TEST_ASSERT_TRUE(simRecord());
+      recorded[session.seq] = session;
+    } else if (r < 70) {
+      std::vector<Session> batch = readBatch(1 + rand() % 3);
+      for (const Session& session : batch) {
+        TEST_ASSERT_TRUE(recorded.count(session.seq) == 1);
+        TEST_ASSERT_EQUAL_STRING(recorded[session.seq].uuid, session.uuid);
+        app[session.uuid] = session.seq;
+      }
+
+      // The link may drop before the ack gets through
+      if (batch.empty() || rand() % 4 == 0) {
+        continue;
+      }
+      if (rand() % 2) {
+        ackUpTo(batch.back().seq);
+        upTo = batch.back().seq > upTo ? batch.back().seq : upTo;
+      } else {
+        ackUuids(batch);
+        for (const Session& session : batch) {
+          uuidAcked[session.seq] = true;
+        }
+      }
+    } else if (r < 90) {
+      // Reconnect
+      syncResume();
+      uint32_t oldest = nextSessionSeq;
+      for (auto& entry : recorded) {
+        if (entry.first > upTo && !uuidAcked[entry.first]) {
+          oldest = entry.first;
+          break;
+        }
+      }
+      TEST_ASSERT_EQUAL_UINT32(oldest, syncCursor);
+      std::vector<Session> batch = readBatch();
+      if (!batch.empty()) {
+        TEST_ASSERT_EQUAL_UINT32(oldest, batch.front().seq);
+      }
+      for (const Session& session : batch) {
+        app[session.uuid] = session.seq;
+      }
+    } else {
+      // Reset. An upTo ack not yet committed is lost, the app resends it.
+      if (rand() % 2) {
+        journaledUpTo = upTo;
+      }
+      upTo = journaledUpTo;
+      ringAckedUpTo = journaledUpTo;
+      simReboot();
+    }
+  }
+
+  // Drain
+  syncResume();
+  for (int guard = 0; pendingSessionCount > 0 && guard < 1000; guard++) {
+    std::vector<Session> batch = readBatch();
+    for (const Session& session : batch) {
+      app[session.uuid] = session.seq;
+    }
+    ackUuids(batch);
+  }
+
+  TEST_ASSERT_EQUAL_INT(0, pendingSessionCount);
+  TEST_ASSERT_EQUAL_UINT32(0, simDropped);
+  TEST_ASSERT_EQUAL_UINT32(recorded.size(), app.size());
+  for (auto& entry : recorded) {
+    TEST_ASSERT_TRUE(app.count(entry.second.uuid) == 1);
+    TEST_ASSERT_EQUAL_UINT32(entry.first, app[entry.second.uuid]);
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_reads_follow_on_before_acks);
+  RUN_TEST(test_disconnect_mid_batch_resumes_at_first_unacked);
+  RUN_TEST(test_partial_uuid_ack_resends_only_the_rest);
+  RUN_TEST(test_up_to_ack_is_idempotent);
+  RUN_TEST(test_uuid_ack_is_idempotent);
+  RUN_TEST(test_resume_point_survives_reboot);
+  RUN_TEST(test_flaky_link);
+  return UNITY_END();
+}